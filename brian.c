@@ -5,994 +5,480 @@
 **********************************/
 
 #include <stdio.h>
-#include <stddef.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-#define DEBUG
-#define MAX_TOKENS 1024
-#define MAX_IDENTIFIER_LENGTH 30
-#define TEMP_BUFFER_SIZE 1000
-
-/***********************************************
- * Structs and Globals
-************************************************/
-
-typedef enum {
-  BINARYOP, VARIABLE, CONSTANT, NUMBER, 
-  IMPLY, QUOTED, PAREN, BRACKET, CURLY, END
-} termtype;
-
-typedef struct TOKENNODE
-{
-  char *identifier;
-  termtype type;
-  struct TOKENNODE *next;
-} tokennode;
-
-typedef struct ASTNODE
-{
-  int serial;
-  char *identifier;
-  termtype type;
-  struct ASTNODE *left;
-  struct ASTNODE *right;
-} astnode;
-
-typedef struct STATEMENTNODE{
-  astnode *statement;
-  struct STATEMENTNODE *next;
-} statementnode;
-
-typedef struct UNIFIER{
-  astnode *var;
-  astnode *term;
-  struct UNIFIER *next;
-} unifier;
-
-typedef struct MATCHEDNODE{
-  astnode *node;
-  unifier *unifiers;
-  struct MATCHEDNODE *next;
-} matchednode;
-
-char *memfile=NULL;
-tokennode *tokens[MAX_TOKENS];
-int tokenindex=0;
-tokennode *postfix[MAX_TOKENS];
-int postfixindex=0;
-tokennode *ops[MAX_TOKENS];
-int opsindex=0;
-astnode *connectives[MAX_TOKENS];
-int connectivesindex=0;
-astnode *output[MAX_TOKENS];
-int outputindex=0;
-statementnode *rules;
-statementnode *program;
-
-/*************************************************
- * Node Creators and Destroyers
-**************************************************/
-
-tokennode *createToken(char *identifier, termtype type){
-  tokennode *t=malloc(sizeof(tokennode));
-  t->type=type;
-  t->identifier=malloc(strlen(identifier)+1);
-  strcpy(t->identifier, identifier);
-  t->next=NULL;
-  return t;
-}
-
-void freeToken(tokennode *token){
-  if(!token) return;
-  tokennode *t=token->next;
-  free(token);
-  while(t){
-    token=t;
-    t=token->next;
-    free(token);
-  }
-}
-
-astnode *createAST(char *identifier, termtype type, int serial){
-  astnode *a=malloc(sizeof(astnode));
-  a->type=type;
-  a->identifier=malloc(strlen(identifier)+1);
-  strcpy(a->identifier, identifier);
-  a->serial=serial;
-  a->left=NULL;
-  a->right=NULL;
-  return a;
-}
-
-void freeAST(astnode *node){
-  if(!node) return;
-  if(node->left) freeAST(node->left);
-  if(node->right) freeAST(node->right);
-  free(node);
-}
+#include "brian.h"
 
-statementnode *createStatement(astnode *stmnt){
-  statementnode *s=malloc(sizeof(statementnode));
-  s->statement=stmnt;
-  s->next=NULL;
-  return s;
-}
-
-void freeStatement(statementnode *stmnt){
-  if(!stmnt) return;
-  statementnode *s=stmnt->next;
-  free(stmnt);
-  while(s){
-    stmnt=s;
-    s=stmnt->next;
-    free(stmnt);
-  }
-}
-
-unifier *createUnifier(astnode *term, astnode *var){
-  unifier *u=malloc(sizeof(unifier));
-  u->var=var,
-  u->term=term;
-  u->next=NULL;
-  return u;
-}
+#define DEBUG
+#define MAX_RULE_VARIABLES 256
+#define WATCH_INTERVAL_MS 250
+#define SAMPLE_INTERVAL_US 1000
 
-void freeUnifier(unifier *u){
-  if(!u) return;
-  unifier *u1=u->next;
-  free(u);
-  while(u1){
-    u=u1;
-    u1=u->next;
-    free(u);
+void printStatements(statementnode *s){
+  while(s!=NULL){
+    char *f=getFormula(s->statement, false);
+    printf("  %s.\n", f);
+    free(f);
+    s=s->next;
   }
 }
 
-matchednode *createMatchedNode(astnode *node, unifier *u){
-  matchednode *m=malloc(sizeof(matchednode));
-  m->node=node;
-  m->unifiers=u;
-  return m;
-}
-
-void freeMatchedNode(matchednode *m){
-  if(!m) return;
-  matchednode *m1=m->next;
-  freeUnifier(m->unifiers);
-  free(m);
-  while(m1){
-    m=m1;
-    m1=m->next;
-    free(m);
+void printMemory(){
+  brianmemory usage;
+  brianMemoryUsage(&usage);
+  printf("Memory (live/peak bytes)...\n");
+  for(int c=0;c<BRIAN_MEMORY_CATEGORIES;c++){
+    printf("  %s: %ld/%ld\n", brianMemoryCategory(c), usage.live[c], usage.peak[c]);
   }
-}
-/*************************************************
- * Stack and List Operations
-**************************************************/
-
-void appendToken(tokennode *token){
-  tokens[tokenindex++]=token;
-}
-
-tokennode *popToken(){
-  return tokens[--tokenindex];
-}
-
-void appendPostfix(tokennode *token){
-  postfix[postfixindex++]=token;
+  printf("  total: %ld/%ld\n", usage.total, usage.totalpeak);
 }
 
-tokennode *popPostfix(){
-  return postfix[--postfixindex];
-}
-
-void appendOps(tokennode *token){
-  ops[opsindex++]=token;
-}
-
-tokennode *popOps(){
-  return ops[--opsindex];
-}
-
-void appendOutput(astnode *ast){
-  output[outputindex++]=ast;
-}
-
-astnode *popOutput(){
-  return output[--outputindex];
-}
+/*********************************************************
+ * C Code Generation
+**********************************************************/
 
-void appendConnective(astnode *ast){
-  connectives[connectivesindex++]=ast;
-}
+// --emit-c turns every rule of a program into a specialised matcher and
+// constructor.  The generated reducer runs passes as brianRun does, each
+// rule in turn over the whole term, but skips a rule whose head symbol is
+// not in the term.  Rewrites report whether they changed a node, so
+// passes are not compared by their formulas.
+// The generated file uses libbrian as its runtime, so it builds with
+//   cc -O2 -I<brian source dir> rules.c -L<brian source dir> -lbrian -pthread -o rules
 
-astnode *popConnective(){
-  return connectives[--connectivesindex];
-}
+const char *termtypeNames[]={
+  "BINARYOP", "VARIABLE", "CONSTANT", "NUMBER", "IMPLY", "BRACKET", "CURLY"
+};
 
-void appendProgram(statementnode *prog){
-  if(program==NULL){
-    program=prog;
-  }
-  else {
-    statementnode *p=program;
-    while(p->next!=NULL){
-      p=p->next;
-    }
-    p->next=prog;
-  }
-}
+typedef struct RULEVARIABLES{
+  char *names[MAX_RULE_VARIABLES];
+  int count;
+} rulevariables;
 
-void appendRule(statementnode *rule){
-  if(rules==NULL){
-    rules=rule;
-  }
-  else {
-    statementnode *r=rules;
-    while(r->next!=NULL){
-      r=r->next;
-    }
-    r->next=rule;
+int findRuleVariable(rulevariables *vars, const char *name){
+  for(int k=0;k<vars->count;k++){
+    if(!strcmp(vars->names[k], name)) return k;
   }
+  return -1;
 }
-/**********************************************
- * Abstract Syntax Tree
-***********************************************/
 
-astnode *copydeepASTNode(astnode *node){
-  astnode *copy = createAST(node->identifier, node->type, node->serial);
-  if(node->left) copy->left=copydeepASTNode(node->left);
-  if(node->right) copy->right=copydeepASTNode(node->right);
-  return copy;  
-}
-
-void replaceVariable(astnode *term, unifier *u){
-  if(term->left){
-    if(!strcmp(term->left->identifier, u->var->identifier)){
-      term->left=copydeepASTNode(u->term);
-    }
-    else{
-      replaceVariable(term->left, u);
-    }
-  }
-  if(term->right){
-    if(!strcmp(term->right->identifier, u->var->identifier)){
-      term->right=copydeepASTNode(u->term);
-    }
-    else{
-      replaceVariable(term->right, u);
-    }
+void emitCString(FILE *f, const char *s){
+  fputc('"', f);
+  for(;*s;s++){
+    unsigned char c=*s;
+    if(c=='"' || c=='\\') fprintf(f, "\\%c", c);
+    else if(c<' ' || c>'~') fprintf(f, "\\%03o", c);
+    else fputc(c, f);
   }
+  fputc('"', f);
 }
 
-bool replaceNode(astnode *node, astnode *match, astnode *replace){
-  if(node->left){
-    if(node->left->serial==match->serial){
-      node->left=replace;
-      return true;
-    }
-    else{
-      if(replaceNode(node->left, match, replace)) return true;
+// emits the checks for pattern against the term held in local nK
+void emitMatchNode(FILE *f, astnode *pattern, int node, int *counter, rulevariables *vars){
+  if(pattern->type==VARIABLE){
+    if(findRuleVariable(vars, pattern->identifier)<0 && vars->count<MAX_RULE_VARIABLES){
+      vars->names[vars->count]=pattern->identifier;
+      fprintf(f, "  v[%d]=n%d;\n", vars->count++, node);
     }
+    return;
   }
-  if(node->right){
-    if(node->right->serial==match->serial){
-      node->right=replace;
-      return true;
-    }
-    else{
-      if(replaceNode(node->right, match, replace)) return true;
-    }
-  }
-  return false;
-}
-
-bool equivalent(astnode *term, astnode *rulehead){
-  bool left=true;
-  bool right=true;
-  if(rulehead->type==VARIABLE) return true;
-  if(term->type!=rulehead->type) return false;
-  if(strcmp(term->identifier,rulehead->identifier)) return false;
-  if(term->left!=NULL){
-    if(rulehead->left==NULL) return false;
-    left=equivalent(term->left, rulehead->left);
+  fprintf(f, "  if(n%d->type!=%s || strcmp(n%d->identifier, ", node, termtypeNames[pattern->type], node);
+  emitCString(f, pattern->identifier);
+  fprintf(f, ")) return false;\n");
+  if(pattern->left){
+    int child=(*counter)++;
+    fprintf(f, "  astnode *n%d=n%d->left;\n  if(!n%d) return false;\n", child, node, child);
+    emitMatchNode(f, pattern->left, child, counter, vars);
   }
-  else if(rulehead->left!=NULL){
-    return false;
-  }
-  if(term->right!=NULL){
-    if(rulehead->right==NULL) return false;
-    right=equivalent(term->right, rulehead->right);
-  }
-  else if(rulehead->right!=NULL){
-    return false;
-  }
-  return left && right;
-}
-
-unifier *unify(astnode *term, astnode *rulenode){
-  if(rulenode->type==VARIABLE) return(createUnifier(term, rulenode));
-  if(strcmp(term->identifier, rulenode->identifier)) return NULL;
-  if(term->type!=rulenode->type) return NULL;
-  unifier *u=NULL;
-  if(term->left){
-    if(!rulenode->left) return NULL;
-    unifier *left=unify(term->left, rulenode->left);
-    if(left) u=left;
-  }
-  else if(rulenode->left){
-    return NULL;
-  }
-  if(term->right){
-    if(!rulenode->right) return NULL;
-    unifier *right=unify(term->right, rulenode->right);
-    if(right){
-      if(u){
-        unifier *u1=u;
-        while(u1->next){
-          u1=u1->next;
-        }
-        u1->next=right;
-      }
-      else{
-        u=right;
-      }
-    }
-  }
-  else if(rulenode->right){
-    return NULL;
-  }
-  return NULL;
-}
-
-matchednode *resolve(astnode *term, astnode *rulehead){
-  matchednode *m=NULL;
-  if(equivalent(term, rulehead)){
-    unifier *u=unify(term, rulehead);
-    if(u){
-      m=createMatchedNode(term, u);
-    }
-  }
-  if(term->left){
-    matchednode *l=resolve(term->left, rulehead);
-    if(l){
-      if(m){
-        m->next=l;
-      }
-      else{
-        m=l;
-      }
-    }
+  else {
+    fprintf(f, "  if(n%d->left) return false;\n", node);
   }
-  if(term->right){
-    matchednode *r=resolve(term->right, rulehead);
-    if(r){
-      if(m){
-        matchednode *m1=m;
-        while(m1->next){
-          m1=m1->next;
-        }
-        m1->next=r;
-      }
-      else{
-        m=r;
-      }
-    }
+  if(pattern->right){
+    int child=(*counter)++;
+    fprintf(f, "  astnode *n%d=n%d->right;\n  if(!n%d) return false;\n", child, node, child);
+    emitMatchNode(f, pattern->right, child, counter, vars);
   }
-  return m;
-}
-
-char *getFormula(astnode *ast, bool paren){
-  bool application=false;
-  char begin[2]="\0\0";
-  char end[2]="\0\0";
-  char *left=NULL;
-  char *mid=NULL;
-  char *right=NULL;
-  switch (ast->type)
-  {
-  case BINARYOP:
-  case IMPLY:
-    if(ast->identifier[0]=='@' && ast->identifier[1]==0) application=true;
-    if(paren && ast->identifier[0]!=','){
-      begin[0]='(';
-    }
-    left=getFormula(ast->left, true);
-    mid=ast->identifier;
-    right=getFormula(ast->right, true);
-    if(paren && ast->identifier[0]!=','){
-      end[0]=')';
-    }
-    break;
-  case VARIABLE:
-  case CONSTANT:
-  case NUMBER:
-    mid=ast->identifier;
-    break;
-  case BRACKET:
-    begin[0]='[';
-    right=getFormula(ast->right, false);
-    end[0]=']';
-    break;
-  case CURLY:
-    begin[0]='{';
-    right=getFormula(ast->right, false);
-    end[0]='}';
-    break;
-  
-  default:
-    break;
-  }
-
-  int len=1;
-  if(begin[0]!=0) len+=1;
-  if(left!=NULL) len+=strlen(left);
-  len+=strlen(ast->identifier);
-  if(application) len+=2;
-  if(right!=NULL) len+=strlen(right);
-  if(end[0]!=0) len+=1;
-  char *formula=(char *) calloc(1, len);
-  if(begin[0]!=0) strcat(formula, begin);
-  if(left!=NULL) strcat(formula, left);
-  if(mid!=NULL) strcat(formula, mid);
-  if(application) strcat(formula, "(");
-  if(right!=NULL) strcat(formula, right);
-  if(application) strcat(formula, ")");
-  if(end[0]!=0) strcat(formula, end);
-  return formula;
+  else {
+    fprintf(f, "  if(n%d->right) return false;\n", node);
+  }
+}
+
+void emitBuildNode(FILE *f, astnode *body, rulevariables *vars){
+  int k=body->type==VARIABLE ? findRuleVariable(vars, body->identifier) : -1;
+  if(k>=0){
+    fprintf(f, "copydeepASTNode(v[%d])", k);
+    return;
+  }
+  fprintf(f, "makeNode(");
+  emitCString(f, body->identifier);
+  fprintf(f, ", %s, ", termtypeNames[body->type]);
+  if(body->left) emitBuildNode(f, body->left, vars);
+  else fprintf(f, "NULL");
+  fprintf(f, ", ");
+  if(body->right) emitBuildNode(f, body->right, vars);
+  else fprintf(f, "NULL");
+  fprintf(f, ")");
+}
+
+bool emitC(const char *pathname, const char *source, statementnode *program){
+  FILE *f=fopen(pathname, "w");
+  if(f==NULL) return false;
+  int nrules=0;
+  for(statementnode *s=program;s!=NULL;s=s->next){
+    if(s->statement && !strcmp(s->statement->identifier, "->")) nrules++;
+  }
+  astnode **rulelist=malloc(sizeof(astnode *)*(nrules+1));
+  nrules=0;
+  for(statementnode *s=program;s!=NULL;s=s->next){
+    if(s->statement && !strcmp(s->statement->identifier, "->")) rulelist[nrules++]=s->statement;
+  }
+
+  fprintf(f, "/* generated by brian --emit-c from %s */\n\n", source);
+  fprintf(f, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include \"brian.h\"\n\n");
+  fprintf(f, "static astnode *makeNode(char *identifier, termtype type, astnode *left, astnode *right){\n");
+  fprintf(f, "  astnode *a=createAST(identifier, type, 0);\n  a->left=left;\n  a->right=right;\n  return a;\n}\n\n");
+  int maxvariables=1;
+  for(int r=0;r<nrules;r++){
+    rulevariables vars;
+    vars.count=0;
+    int counter=1;
+    char *formula=getFormula(rulelist[r], false);
+    fprintf(f, "// ");
+    for(char *c=formula;*c;c++) fputc(*c=='\n' ? ' ' : *c, f);
+    fprintf(f, ".\nstatic bool matchRule%d(astnode *n0, astnode **v){\n", r);
+    emitMatchNode(f, rulelist[r]->left, 0, &counter, &vars);
+    if(vars.count>maxvariables) maxvariables=vars.count;
+    fprintf(f, "  return true;\n}\n\n");
+    fprintf(f, "static astnode *buildRule%d(astnode **v){\n  return ", r);
+    emitBuildNode(f, rulelist[r]->right, &vars);
+    fprintf(f, ";\n}\n\n");
+    free(formula);
+  }
+
+  // the distinct head symbols in rule order, so that the hottest come
+  // first when the rules are ordered by a profile
+  const char **symbols=malloc(sizeof(char *)*(nrules+1));
+  int *rulesymbol=malloc(sizeof(int)*(nrules+1));
+  int nsymbols=0;
+  for(int r=0;r<nrules;r++){
+    astnode *head=rulelist[r]->left;
+    rulesymbol[r]=-1;
+    if(matchesAnySymbol(head)) continue;
+    const char *symbol=headSymbol(head);
+    for(int k=0;k<nsymbols && rulesymbol[r]<0;k++){
+      if(!strcmp(symbols[k], symbol)) rulesymbol[r]=k;
+    }
+    if(rulesymbol[r]<0){
+      rulesymbol[r]=nsymbols;
+      symbols[nsymbols++]=symbol;
+    }
+  }
+  fprintf(f, "#define RULE_VARIABLES %d\n#define SYMBOLS %d\n\n", maxvariables, nsymbols);
+  fprintf(f, "// the head symbols of the rules, in rule order\n");
+  fprintf(f, "static int symbolOf(astnode *t){\n  const char *symbol=headSymbol(t);\n");
+  for(int k=0;k<nsymbols;k++){
+    fprintf(f, "  if(!strcmp(symbol, ");
+    emitCString(f, symbols[k]);
+    fprintf(f, ")) return %d;\n", k);
+  }
+  fprintf(f, "  return -1;\n}\n\n");
+
+  // the rules in source order, each with its head symbol, or -1 for a
+  // head such as X@Y that can match a term of any symbol
+  fprintf(f, "typedef struct COMPILEDRULE{\n  bool (*match)(astnode *n0, astnode **v);\n");
+  fprintf(f, "  astnode *(*build)(astnode **v);\n  int symbol;\n} compiledrule;\n\n");
+  fprintf(f, "static compiledrule rules[]={\n");
+  for(int r=0;r<nrules;r++) fprintf(f, "  {matchRule%d, buildRule%d, %d},\n", r, r, rulesymbol[r]);
+  fprintf(f, "  {NULL, NULL, -1}\n};\n\n");
+
+  fprintf(f, "%s",
+    "// a match, by the slot that holds it, its span of preorder positions and\n"
+    "// the terms its variables are bound to\n"
+    "typedef struct COMPILEDMATCH{\n"
+    "  astnode **slot;\n"
+    "  long start;\n"
+    "  long end;\n"
+    "  astnode *v[RULE_VARIABLES];\n"
+    "} compiledmatch;\n"
+    "\n"
+    "typedef struct MATCHLIST{\n"
+    "  compiledmatch *items;\n"
+    "  long count;\n"
+    "  long capacity;\n"
+    "} matchlist;\n"
+    "\n"
+    "// marks the head symbols that occur in t and returns its structural hash\n"
+    "static unsigned long long markSymbols(astnode *t, bool *present){\n"
+    "  int symbol=symbolOf(t);\n"
+    "  if(symbol>=0) present[symbol]=true;\n"
+    "  unsigned long long h=14695981039346656037ull^(unsigned long long)t->type;\n"
+    "  for(const char *c=t->identifier;*c;c++) h=(h^(unsigned char)*c)*1099511628211ull;\n"
+    "  h=(h^(t->left ? markSymbols(t->left, present) : 1))*1099511628211ull;\n"
+    "  h=(h^(t->right ? markSymbols(t->right, present) : 2))*1099511628211ull;\n"
+    "  return h;\n"
+    "}\n"
+    "\n"
+    "// collects the nodes rule matches in preorder, as brianRun does\n"
+    "static long collectMatches(compiledrule *rule, astnode **slot, long index, matchlist *m){\n"
+    "  astnode *t=*slot;\n"
+    "  long k=-1;\n"
+    "  if(m->count==m->capacity){\n"
+    "    m->capacity=m->capacity ? m->capacity*2 : 64;\n"
+    "    m->items=realloc(m->items, sizeof(compiledmatch)*m->capacity);\n"
+    "  }\n"
+    "  if(rule->match(t, m->items[m->count].v)){\n"
+    "    k=m->count++;\n"
+    "    m->items[k].slot=slot;\n"
+    "    m->items[k].start=index;\n"
+    "  }\n"
+    "  index++;\n"
+    "  if(t->left) index=collectMatches(rule, &t->left, index, m);\n"
+    "  if(t->right) index=collectMatches(rule, &t->right, index, m);\n"
+    "  if(k>=0) m->items[k].end=index;\n"
+    "  return index;\n"
+    "}\n"
+    "\n"
+    "// Rewrites every match of rule, except those inside a node the rule has\n"
+    "// already rewritten, frees the nodes it replaces and marks the symbols\n"
+    "// the replacements bring in.  Returns true if a replacement differs from\n"
+    "// the node it replaced.\n"
+    "static bool applyRule(compiledrule *rule, astnode **prog, matchlist *m, bool *present){\n"
+    "  long skip=0;\n"
+    "  bool changed=false;\n"
+    "  m->count=0;\n"
+    "  collectMatches(rule, prog, 0, m);\n"
+    "  for(long k=0;k<m->count;k++){\n"
+    "    if(m->items[k].start<skip) continue;\n"
+    "    astnode *node=*m->items[k].slot;\n"
+    "    astnode *replacement=rule->build(m->items[k].v);\n"
+    "    if(!sameTerm(node, replacement)) changed=true;\n"
+    "    markSymbols(replacement, present);\n"
+    "    *m->items[k].slot=replacement;\n"
+    "    freeAST(node);\n"
+    "    skip=m->items[k].end;\n"
+    "  }\n"
+    "  return changed;\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char const *argv[]){\n"
+    "  if(argc != 2){\n"
+    "    printf(\"usage: %s programfile\\n\", argv[0]);\n"
+    "    return 1;\n"
+    "  }\n"
+    "  brianengine *e=brianCreate();\n"
+    "  int errors=brianLoadFile(e, argv[1]);\n"
+    "  if(brianErrors(e)) printf(\"%s\", brianErrors(e));\n"
+    "  if(errors<0) return 1;\n"
+    "  matchlist m={NULL, 0, 0};\n"
+    "  bool present[SYMBOLS+1];\n"
+    "  for(statementnode *s=brianStatements(e);s!=NULL;s=s->next){\n"
+    "    if(!s->statement || !strcmp(s->statement->identifier, \"->\")) continue;\n"
+    "    memset(present, 0, sizeof(present));\n"
+    "    unsigned long long hash=markSymbols(s->statement, present);\n"
+    "    astnode *confirm=NULL;\n"
+    "    // passes over the rules until one leaves the term unchanged\n"
+    "    while(true){\n"
+    "      bool changed=false;\n"
+    "      for(compiledrule *rule=rules;rule->match;rule++){\n"
+    "        if(rule->symbol>=0 && !present[rule->symbol]) continue;\n"
+    "        if(applyRule(rule, &s->statement, &m, present)) changed=true;\n"
+    "      }\n"
+    "      if(confirm){\n"
+    "        bool same=sameTerm(confirm, s->statement);\n"
+    "        freeAST(confirm);\n"
+    "        confirm=NULL;\n"
+    "        if(same) break;\n"
+    "      }\n"
+    "      if(!changed) break;\n"
+    "      memset(present, 0, sizeof(present));\n"
+    "      unsigned long long passend=markSymbols(s->statement, present);\n"
+    "      // Rewrites that undo one another, as a->b then b->a do, leave the\n"
+    "      // term as the pass found it, which ends brianRun.  The next pass\n"
+    "      // repeats them, so it is compared exactly with a copy.\n"
+    "      if(passend==hash) confirm=copydeepASTNode(s->statement);\n"
+    "      hash=passend;\n"
+    "    }\n"
+    "    char *formula=getFormula(s->statement, false);\n"
+    "    printf(\"%s.\\n\", formula);\n"
+    "    free(formula);\n"
+    "  }\n"
+    "  free(m.items);\n"
+    "  brianDestroy(e);\n"
+    "  return 0;\n"
+    "}\n");
+  free(symbols);
+  free(rulesymbol);
+  free(rulelist);
+  fclose(f);
+  return true;
 }
 
-void astTokens(){
-  int i=0;
-  int nodecounter=0;
-  while(i<postfixindex){
-    tokennode *tnode=postfix[i];
-    astnode *ast=NULL;
-    switch (tnode->type)
-    {
-    case BRACKET:
-      if(tnode->identifier[0]==']'){
-        astnode *temp[MAX_TOKENS];
-        int tempi=0;
-        astnode *right=popOutput();
-        while(right->identifier[0]!='['){
-          if(connectivesindex>0){
-            ast=popConnective();
-            ast->right=right;
-            temp[tempi++]=ast;
-          }
-          right=popOutput();
-        }
-        for(int tempj=0;tempj<tempi;tempj++){
-          appendOutput(temp[tempj]);
-        }
-      }
-      else {
-        ast=createAST(tnode->identifier, tnode->type, nodecounter++);
-        appendOutput(ast);
-        appendConnective(ast);
-      }
-      break;
-    case CURLY:
-      if(tnode->identifier[0]=='}'){
-        astnode *temp[MAX_TOKENS];
-        int tempi=0;
-        astnode *right=popOutput();
-        while(right->identifier[0]!='{'){
-          if(connectivesindex>0){
-            ast=popConnective();
-            ast->right=right;
-            temp[tempi++]=ast;
-          }
-          right=popOutput();
-        }
-        for(int tempj=0;tempj<tempi;tempj++){
-          appendOutput(temp[tempj]);
-        }
-      }
-      else {
-        ast=createAST(tnode->identifier, tnode->type, nodecounter++);
-        appendOutput(ast);
-        appendConnective(ast);
-      }
-      break;
-    case CONSTANT:
-    case VARIABLE:
-    case NUMBER:
-      ast=createAST(tnode->identifier, tnode->type, nodecounter++);
-      appendOutput(ast);
-      break;
-    case BINARYOP:
-    case IMPLY:
-      astnode *right=popOutput();
-      astnode *left=popOutput();
-      ast=createAST(tnode->identifier, tnode->type, nodecounter++);
-      ast->right=right;
-      ast->left=left;
-      appendOutput(ast);
-      break;
+/*********************************************************
+ * Watch Mode
+**********************************************************/
 
-    case END:
-      ast=popOutput();
-      statementnode *p=createStatement(ast);
-      appendProgram(p);
-      break;
-    
-    default:
-      break;
-    }
-    //freeToken(tnode);
-    i++;
-  }
+// Reruns the program whenever its file changes.  Unchanged statements are
+// not parsed again, and statements whose rules are unchanged keep their
+// earlier results.
+int watchProgram(brianengine *e, const char *programfile){
+  struct timespec modified={0, 0};
+  off_t size=-1;
+  brianSetIncremental(e, true);
+  while(true){
+    struct stat st;
+    if(stat(programfile, &st)==0 && (st.st_mtim.tv_sec!=modified.tv_sec
+    || st.st_mtim.tv_nsec!=modified.tv_nsec || st.st_size!=size)){
+      modified=st.st_mtim;
+      size=st.st_size;
+      brianReloadFile(e, programfile);
+      if(brianErrors(e)) printf("%s", brianErrors(e));
+      brianRun(e);
+      if(brianErrors(e)) printf("%s", brianErrors(e));
+      printf("After...\n");
+      printStatements(brianStatements(e));
+      printf("Parsed %d and reduced %d statements\n\n", brianParsedCount(e), brianReducedCount(e));
+      fflush(stdout);
+    }
+    usleep(WATCH_INTERVAL_MS*1000);
+  }
+  return 0;
 }
 
-void postfixTokens(){
-  int t=0;
-  while(t<tokenindex){
-    tokennode *tnode=tokens[t];
-    switch (tnode->type)
-    {
-    case PAREN:
-      if(tnode->identifier[0]==')'){
-        tokennode *op=popOps();
-        while(op->identifier[0]!='('){
-          appendPostfix(op);
-          op=popOps();
-        }
-        // freeToken(op);
-        appendPostfix(tnode);
-      }
-      else {
-        appendPostfix(tnode);
-        appendOps(tnode);
-      }
-      break;
-    case BRACKET:
-      if(tnode->identifier[0]==']'){
-        tokennode *op=popOps();
-        while(op->identifier[0]!='['){
-          appendPostfix(op);
-          op=popOps();
-        }
-        // freeToken(op);
-        appendPostfix(tnode);
-      }
-      else {
-        appendPostfix(tnode);
-        appendOps(tnode);
-      }
-      break;
-    case CURLY:
-      if(tnode->identifier[0]=='}'){
-        tokennode *op=popOps();
-        while(op->identifier[0]!='{'){
-          appendPostfix(op);
-          op=popOps();
-        }
-        // freeToken(op);
-        appendPostfix(tnode);
-      }
-      else {
-        appendPostfix(tnode);
-        appendOps(tnode);
-      }
-      break;
-    case VARIABLE:
-    case CONSTANT:
-    case NUMBER:
-    case QUOTED:
-      appendPostfix(tnode);
-      break;
-    case BINARYOP:
-    case IMPLY:
-      if(opsindex>0){
-        if(tnode->identifier[0]==','){
-          tokennode *op=popOps();
-          if(op->identifier[0]==','){
-            // comma is right associative
-            appendOps(op);
-          }
-          else {
-            while((op->type!=PAREN || op->identifier[0]!='(')
-            && (op->type!=BRACKET || op->identifier[0]!='[')
-            && (op->type!=CURLY || op->identifier[0]!='{') 
-            && opsindex>0){
-              appendPostfix(op);
-              op=popOps();
-            }
-            if((op->type==PAREN && op->identifier[0]=='(')
-            || (op->type==BRACKET && op->identifier[0]=='[')
-            || (op->type==CURLY && op->identifier[0]=='{') ){
-              appendOps(op);
-            }
-          }
-        }
-        else {
-          // handle all left associative binary operators
-          tokennode *op=popOps();
-          if((op->type!=PAREN || op->identifier[0]!='(')
-          && (op->type!=BRACKET || op->identifier[0]!='[')
-          && (op->type!=CURLY || op->identifier[0]!='{') ){
-            appendPostfix(op);
-          }
-          else {
-            appendOps(op);
-          }        
-        }
-      }
-      appendOps(tnode);        
-      break;
-    case END:
-      while(opsindex>0){
-        appendPostfix(popOps());
-      }
-      appendPostfix(tnode);
-      break;
-    
-    default:
-      break;
-    }
-    t++;
-  }
-// replace quoted strings with comma-delimited lists of characters
-// comma is the only right-associative binary operator to force 
-// head/tail functionality to behave as expected
-  tokennode *temp[MAX_TOKENS];
-  int tempi=0;
-  int pfi=0;
-  while(pfi<postfixindex){
-    tokennode *node=postfix[pfi++];
-    if(node->type==QUOTED){
-      tokennode *brack=createToken("[",BRACKET);
-      temp[tempi++]=brack;
-      for(int j=1;j<strlen(node->identifier)-1;j++){
-        char tc[2]="\0\0";
-        tc[0]=node->identifier[j];
-        tokennode *character=createToken(tc, CONSTANT);
-        temp[tempi++]=character;
-      }
-      for(int j=1;j<strlen(node->identifier)-2;j++){
-        tokennode *comma=createToken(",",BINARYOP);
-        temp[tempi++]=comma;
-      }
-      temp[tempi++]=createToken("]",BRACKET);
-    }
-    else {
-      temp[tempi++]=node;
+int main(int argc, char const *argv[]){
+  const char *programfile=NULL;
+  const char *emitfile=NULL;
+  brianbudget budget={0, 0, 0};
+  briancyclecheck cyclecheck=BRIAN_CYCLES_OFF;
+  int cyclewindow=0;
+  bool compact=false;
+  bool watch=false;
+  const char *profileout=NULL;
+  const char *profilein=NULL;
+  bool partialeval=false;
+  const char *sampleout=NULL;
+  long maxmemory=0;
+  long maxrunmemory=0;
+  bool memoryreport=false;
+  for(int a=1;a<argc;a++){
+    if(!strcmp(argv[a], "--emit-c") && a+1<argc){
+      emitfile=argv[++a];
     }
-  }
-  for(int tempj=0;tempj<tempi;tempj++){
-    postfix[tempj]=temp[tempj];
-  }
-  postfixindex=tempi;
-
-
-  astTokens();
-}
-
-void tokenizeMemFile(long memfilelength){
-  int i=0;
-  bool inword=false;
-  bool inop=false;
-  bool innum=false;
-  char identifier[MAX_IDENTIFIER_LENGTH+1];
-  int identindex=0;
-  termtype wordtype;
-  tokennode *tnode=NULL;
-  while(i<memfilelength){
-    char c=memfile[i];
-    char nc='\0';
-    if(i+1<memfilelength){
-      nc=memfile[i+1];
+    else if(!strcmp(argv[a], "--max-steps") && a+1<argc){
+      budget.maxsteps=atol(argv[++a]);
     }
-    if(c==' ' || c=='\n' || c=='\t' || c=='(' || c==')' 
-     || c=='[' || c==']' || c=='{' || c=='}' || c==',' 
-     || c=='.' || c=='"' || c=='#'){
-      if(inword){
-        identifier[identindex]=0;
-        tnode=createToken(identifier, wordtype);
-        appendToken(tnode);
-        inword=false;
-      } 
-      if(inop){
-        identifier[identindex]=0;
-        tnode=createToken(identifier, BINARYOP);
-        appendToken(tnode);
-        inop=false;
-      }
-      if(innum && !isdigit(nc)){
-        identifier[identindex]=0;
-        tnode=createToken(identifier, NUMBER);
-        appendToken(tnode);
-        innum=false;
-      }
+    else if(!strcmp(argv[a], "--max-nodes") && a+1<argc){
+      budget.maxnodes=atol(argv[++a]);
     }
-    if(c=='(' || c==')'){
-      char id[2];
-      id[0]=c;
-      id[1]='\0';
-      tnode=createToken(id, PAREN);
-      appendToken(tnode);
+    else if(!strcmp(argv[a], "--max-ms") && a+1<argc){
+      budget.maxmillis=atol(argv[++a]);
     }
-    else if(c=='[' || c==']'){
-      char id[2];
-      id[0]=c;
-      id[1]='\0';
-      tnode=createToken(id, BRACKET);      
-      appendToken(tnode);
+    else if(!strcmp(argv[a], "--cycle-window") && a+1<argc){
+      cyclecheck=BRIAN_CYCLES_WINDOW;
+      cyclewindow=atoi(argv[++a]);
     }
-    else if(c=='{' || c=='}'){
-      char id[2];
-      id[0]=c;
-      id[1]='\0';
-      tnode=createToken(id, CURLY);      
-      appendToken(tnode);
+    else if(!strcmp(argv[a], "--cycle-brent")){
+      cyclecheck=BRIAN_CYCLES_BRENT;
     }
-    else if(c==','){
-      char id[2];
-      id[0]=c;
-      id[1]='\0';
-      tnode=createToken(id, BINARYOP);      
-      appendToken(tnode);
+    else if(!strcmp(argv[a], "--compact")){
+      compact=true;
     }
-    else if(c=='-' && nc=='>'){
-      tnode=createToken("->", IMPLY);
-      appendToken(tnode);
-      i++;
+    else if(!strcmp(argv[a], "--watch")){
+      watch=true;
     }
-    else if(c=='#'){
-      while(c!='\n' && i<memfilelength) c=memfile[++i];
+    else if(!strcmp(argv[a], "--profile-out") && a+1<argc){
+      profileout=argv[++a];
     }
-    else if(c=='"'){
-      char buffer[TEMP_BUFFER_SIZE];
-      int bi=0;
-      int quotecount=0;
-      while(quotecount<2){
-        buffer[bi++]=c;
-        if(c=='"') quotecount++;
-        if(i+1>=memfilelength){
-          buffer[bi++]='"';
-          buffer[bi]=0;
-        }
-        else {
-          c=memfile[++i];
-        }
-      }
-      i--;
-      tnode=createToken(buffer, QUOTED);
-      appendToken(tnode);
+    else if(!strcmp(argv[a], "--profile-in") && a+1<argc){
+      profilein=argv[++a];
     }
-    else if(!innum && !inword && !inop && c=='-' && isdigit(nc)){
-      innum=true;
-      identindex=0;
-      identifier[identindex++]=c;
-      identifier[identindex++]=nc;
-      i++;
+    else if(!strcmp(argv[a], "--partial-eval")){
+      partialeval=true;
     }
-    else if(innum && c=='.' && isdigit(nc)){
-      identifier[identindex++]=c;
-      identifier[identindex++]=nc;
-      i++;
+    else if(!strcmp(argv[a], "--sample-out") && a+1<argc){
+      sampleout=argv[++a];
     }
-    else if(isdigit(c)){
-      if(innum){
-        identifier[identindex++]=c;
-      }
-      else{
-        if(inop){
-          identifier[identindex]=0;
-          tnode=createToken(identifier, BINARYOP);
-          appendToken(tnode);
-          inop=false;
-        }
-        if(inword){
-          identifier[identindex]=0;
-          tnode=createToken(identifier, wordtype);
-          appendToken(tnode);
-          inword=false;
-        }
-        innum=true;
-        identindex=0;
-        identifier[identindex++]=c;
-      }
+    else if(!strcmp(argv[a], "--max-memory") && a+1<argc){
+      maxmemory=atol(argv[++a]);
     }
-    else if(isalnum(c)){
-      if(inword){
-        identifier[identindex++]=c;
-      }
-      else{
-        if(inop){
-          identifier[identindex]=0;
-          tnode=createToken(identifier, BINARYOP);
-          appendToken(tnode);
-          inop=false;
-        }
-        if(innum){
-          identifier[identindex]=0;
-          tnode=createToken(identifier, NUMBER);
-          appendToken(tnode);
-          innum=false;
-        }
-        inword=true;
-        if(isupper(c)){
-          wordtype=VARIABLE;
-        }
-        else {
-          wordtype=CONSTANT;
-        }
-        identindex=0;
-        identifier[identindex++]=c;
-      }
+    else if(!strcmp(argv[a], "--max-run-memory") && a+1<argc){
+      maxrunmemory=atol(argv[++a]);
     }
-    else if(c=='.'){
-      char id[2];
-      id[0]=c;
-      id[1]='\0';
-      tnode=createToken(id, END);      
-      appendToken(tnode);
-      postfixTokens();
-      for(int t=0;t<tokenindex;t++){
-        freeToken(tokens[t]);
-      }
-      tokenindex=0;
-      postfixindex=0;
-      opsindex=0;
-      outputindex=0;
-      connectivesindex=0;
+    else if(!strcmp(argv[a], "--memory-report")){
+      memoryreport=true;
     }
-    else if(c!=' ' && c!='\n' && c!='\t'){
-      if(inop){
-        identifier[identindex++]=c;
-      }
-      else {
-        if(inword){
-          identifier[identindex]=0;
-          tnode=createToken(identifier, wordtype);
-          appendToken(tnode);
-          inword=false;
-        }
-        if(innum){
-          identifier[identindex]=0;
-          tnode=createToken(identifier, NUMBER);
-          appendToken(tnode);
-          innum=false;
-        }
-        inop=true;
-        identindex=0;
-        identifier[identindex++]=c;
-      }
+    else {
+      programfile=argv[a];
     }
-    i++;
   }
-  // postfixTokens();
-}
-
-/*********************************************************
- * FILE I/O 
-**********************************************************/
-long getFileSize(const char *pathname){
-  long sz;
-  FILE *f;
-
-  f = fopen(pathname, "r");
-  if(f == NULL) return 0;
-  fseek(f, 0L, SEEK_END);
-  sz = ftell(f);
-  fclose(f);
-  return sz;
-}
-
-char *loadMemFile(const char *pathname){
-  char c;
-  long sz = getFileSize(pathname);
-  long i = 0;
-  memfile = malloc(sz+1);
-  if(memfile == NULL) return NULL;
-  FILE *f = fopen(pathname, "r");
-  if(f == NULL) return NULL;
-  do
-  {
-    c = fgetc(f);
-    memfile[i++] = c;
-  } while (c != EOF);
-  
-  fclose(f);
-  tokenizeMemFile(sz);
-}
-
-void runProgram(){
-  statementnode *stmnt=program;
-  while(stmnt!=NULL){
-    astnode *prog=stmnt->statement;
-    if(prog){
-      // put Rules in the Rules list
-      if(!strcmp(prog->identifier,"->")){
-        statementnode *newstmnt=createStatement(prog);
-        appendRule(newstmnt);
-      }
-      else{
-        // reduce program line
-        bool changed=true;
-        while(changed){
-          char *proga=getFormula(prog,false);
-          changed=false;
-          statementnode *rulelist=rules;
-          while(rulelist!=NULL){
-            astnode *rule=rulelist->statement;
-            if(rule){
-              astnode *rulehead=rule->left;             
-              astnode *rulebody=copydeepASTNode(rule->right);
-              matchednode *mn=resolve(prog, rulehead);
-              if(mn){
-                matchednode *mnx=mn;
-                while(mnx){
-                  unifier *u=mnx->unifiers;
-                  while(u){
-                    if(!strcmp(rulebody->identifier, u->var->identifier)){
-                      rulebody=copydeepASTNode(u->term);
-                    }
-                    else{
-                      replaceVariable(rulebody, u);
-                    }
-                    u=u->next;
-                  }
-                  char *rbafter=getFormula(rulebody, false);
+  brianengine *e=brianCreate();
+  printf("Brian\nCopyright (c) 2023 Brian O'Dell\n\n");
 #ifdef DEBUG
-                  printf("Statement - %s.\n", getFormula(prog, false));
-                  printf("  Rule - %s.\n", getFormula(rule, false));
-                  printf("    Matched Node - %s.\n", getFormula(mnx->node, false));
-                  printf("      Transformed Node - %s.\n", rbafter);
+  if(!programfile) programfile="/home/brian/git/brian-c/test";
 #endif
-                  if(mnx->node->serial==prog->serial){
-                    prog=rulebody;
-                  }
-                  else{
-                    replaceNode(prog, mnx->node, rulebody);
-                  }
-                  mnx=mnx->next;
-                }
-              }
-            }
-            rulelist=rulelist->next;
-          }
-          char *progb=getFormula(prog, false);
-          if(strcmp(proga,progb)) changed=true;
-        }
-        stmnt->statement=prog;
-      }
-    }
-    stmnt=stmnt->next;
+  if(!programfile){
+    printf("usage: brian [--emit-c output.c] [--max-steps n] [--max-nodes n] [--max-ms n] [--cycle-window n | --cycle-brent] [--compact] [--watch] [--profile-out file] [--profile-in file] [--partial-eval] [--sample-out file] [--max-memory n] [--max-run-memory n] [--memory-report] programfile\n");
+    brianDestroy(e);
+    return 1;
   }
-
-}
-
-int main(int argc, char const *argv[]){
-  printf("Brian\nCopyright (c) 2023 Brian O'Dell\n\n");
 #ifdef DEBUG
-  loadMemFile("/home/brian/git/brian-c/test");
-#else
-  if(argc != 2){
-    printf("usage: brian programfile\n");
+  brianSetTrace(e, true);
+#endif
+  brianSetBudget(e, &budget);
+  brianSetCycleCheck(e, cyclecheck, cyclewindow);
+  brianSetMemoryLimit(e, maxmemory, maxrunmemory);
+  if(watch){
+    // watch mode only reruns the program; say so rather than ignore these
+    const char *other=emitfile ? "--emit-c" : compact ? "--compact" : profilein ? "--profile-in"
+      : profileout ? "--profile-out" : partialeval ? "--partial-eval" : sampleout ? "--sample-out"
+      : memoryreport ? "--memory-report" : NULL;
+    if(other){
+      printf("--watch cannot be used with %s\n", other);
+      brianDestroy(e);
+      return 1;
+    }
+    return watchProgram(e, programfile);
+  }
+  int errors=brianLoadFile(e, programfile);
+  if(brianErrors(e)) printf("%s", brianErrors(e));
+  if(errors<0){
+    brianDestroy(e);
     return 1;
   }
-#endif
+  if(profilein && brianOrderRules(e, profilein)<0){
+    printf("%s", brianErrors(e));
+    brianDestroy(e);
+    return 1;
+  }
+  if(partialeval) brianPartialEvaluate(e);
+  if(emitfile){
+    bool emitted=emitC(emitfile, programfile, brianStatements(e));
+    brianDestroy(e);
+    if(!emitted){
+      printf("cannot write %s\n", emitfile);
+      return 1;
+    }
+    return 0;
+  }
   printf("Before...\n");
-  statementnode *s=program;
-  while(s!=NULL){
-    char *f=getFormula(s->statement, false);
-    printf("  %s.\n", f);
-    s=s->next;
+  printStatements(brianStatements(e));
+  brianSetProfiling(e, profileout!=NULL);
+  if(sampleout) brianStartSampling(e, SAMPLE_INTERVAL_US);
+  if(compact){
+    brianRunCompact(e);
   }
-  runProgram();
-  printf("After...\n");
-  s=program;
-  while(s!=NULL){
-    char *f=getFormula(s->statement, false);
-    printf("  %s.\n", f);
-    s=s->next;
+  else {
+    brianRun(e);
   }
-
-}
\ No newline at end of file
+  brianStopSampling(e);
+  if(brianErrors(e)) printf("%s", brianErrors(e));
+  printf("After...\n");
+  printStatements(brianStatements(e));
+  if(profileout && !brianWriteProfile(e, profileout)) printf("cannot write %s\n", profileout);
+  if(sampleout && !brianWriteSamples(e, sampleout)) printf("cannot write %s\n", sampleout);
+  if(memoryreport) printMemory();
+  brianDestroy(e);
+  return 0;
+}
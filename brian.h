@@ -0,0 +1,249 @@
+/*********************************
+* Brian
+* Copyright (c) 2023 Brian O'Dell
+*
+**********************************/
+
+#ifndef BRIAN_H
+#define BRIAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * Terms
+************************************************/
+
+typedef enum {
+  BINARYOP, VARIABLE, CONSTANT, NUMBER,
+  IMPLY, BRACKET, CURLY
+} termtype;
+
+typedef struct ASTNODE
+{
+  int serial;
+  // while sampling, the chain of rewrites that built the node
+  int chain;
+  char *identifier;
+  termtype type;
+  struct ASTNODE *left;
+  struct ASTNODE *right;
+} astnode;
+
+typedef struct STATEMENTNODE{
+  astnode *statement;
+  struct STATEMENTNODE *next;
+} statementnode;
+
+astnode *createAST(char *identifier, termtype type, int serial);
+astnode *createASTLength(const char *identifier, long length, termtype type, int serial);
+astnode *copydeepASTNode(astnode *node);
+void freeAST(astnode *node);
+bool sameTerm(astnode *a, astnode *b);
+const char *headSymbol(astnode *term);
+// true for a head, such as X or F@Y, that can match any head symbol
+bool matchesAnySymbol(astnode *head);
+// the returned string is allocated and owned by the caller
+char *getFormula(astnode *ast, bool paren);
+
+/***********************************************
+ * Engine
+************************************************/
+
+// An engine owns a rule set, a program and the result of its last
+// reduction.  Engines share no state, so separate engines may be used
+// from separate threads at the same time.
+typedef struct BRIANENGINE brianengine;
+
+// Limits on a single reduction, or on each slice of one; zero means no
+// limit.  Nodes counts the size of the term being reduced.
+typedef struct BRIANBUDGET{
+  long maxsteps;
+  long maxnodes;
+  long maxmillis;
+} brianbudget;
+
+typedef enum {
+  BRIAN_DONE, BRIAN_SUSPENDED, BRIAN_STEPS_EXHAUSTED,
+  BRIAN_NODES_EXHAUSTED, BRIAN_TIME_EXHAUSTED, BRIAN_CYCLE,
+  BRIAN_MEMORY_EXHAUSTED
+} brianstatus;
+
+typedef enum {
+  BRIAN_CYCLES_OFF, BRIAN_CYCLES_WINDOW, BRIAN_CYCLES_BRENT
+} briancyclecheck;
+
+// Bytes of memory the library holds, by what it holds them for.
+typedef enum {
+  BRIAN_MEMORY_NODES, BRIAN_MEMORY_UNIFIERS, BRIAN_MEMORY_MATCHES,
+  BRIAN_MEMORY_FORMULAS, BRIAN_MEMORY_CATEGORIES
+} brianmemorycategory;
+
+typedef struct BRIANMEMORY{
+  long live[BRIAN_MEMORY_CATEGORIES];
+  long peak[BRIAN_MEMORY_CATEGORIES];
+  long total;
+  long totalpeak;
+} brianmemory;
+
+// A reduction that can be stopped when its budget runs out and resumed.
+typedef struct BRIANREDUCTION brianreduction;
+
+// The first engine created gives standard output a 1 MiB buffer when it
+// is not a terminal, so create it before writing to stdout.
+brianengine *brianCreate();
+void brianDestroy(brianengine *e);
+void brianSetTrace(brianengine *e, bool trace);
+
+// Append the statements of a program to the engine; rules in it take
+// effect from their position onward when the program is run.  Returns
+// the number of statements skipped for syntax errors, or -1 if the file
+// cannot be read.
+int brianLoad(brianengine *e, const char *text, long length);
+int brianLoadFile(brianengine *e, const char *pathname);
+
+// Add every rule in text to the rule set straight away; statements that
+// are not rules are reported as errors.
+int brianLoadRules(brianengine *e, const char *text, long length);
+
+// Messages for the errors of the last load, parse, run or resume, or NULL.
+const char *brianErrors(brianengine *e);
+
+// Budget given to each statement by brianRun, and again by every
+// brianResume; NULL removes any limit.
+void brianSetBudget(brianengine *e, brianbudget *budget);
+
+// Optional detection of reductions that revisit an earlier term, checked
+// by structural hash after every pass over the rules and confirmed by
+// comparing the terms.  WINDOW keeps copies of the last window terms;
+// BRENT finds cycles of any length keeping one, a few passes later.  A
+// cycling reduction stops with BRIAN_CYCLE.
+void brianSetCycleCheck(brianengine *e, briancyclecheck check, int window);
+
+// Stop a statement whose reduction grows the bytes in use by more than
+// perstatement, or whose run has grown them by more than perrun; zero
+// means no limit.  The statement is replaced by the constant aborted,
+// its memory is released and the rest of the program still runs.  Memory
+// is measured where the C library reports the size of an allocation
+// (glibc, FreeBSD and macOS); elsewhere it reads zero and no limit
+// applies.
+void brianSetMemoryLimit(brianengine *e, long perstatement, long perrun);
+
+// Live and peak bytes of terms, unifier lists, match lists and formula
+// strings allocated by the library on the calling thread.  Formula
+// strings handed to the caller are no longer counted.
+void brianMemoryUsage(brianmemory *usage);
+const char *brianMemoryCategory(brianmemorycategory category);
+
+// Reduce every loaded statement in order, in place, making any input
+// and output calls (see the README) as it goes.  A statement whose budget
+// runs out keeps its partially reduced term and is suspended.  Returns
+// the number of suspended statements.
+int brianRun(brianengine *e);
+
+// Give every suspended statement another budget in turn, so that long
+// reductions share time fairly.  Returns the number still suspended.
+int brianResume(brianengine *e);
+
+// Replace the program (and the rules it added when run) with the one in
+// text.  Only statements whose text changed since the last reload are
+// parsed again.  Returns as brianLoad.
+int brianReload(brianengine *e, const char *text, long length);
+int brianReloadFile(brianengine *e, const char *pathname);
+
+// Keep the result of every statement brianRun reduces, and reuse it for
+// the same statement as long as none of the rules its reduction could
+// have used has changed.  Statements that make input or output calls are
+// always reduced again, and brianReload drops the results of statements
+// no longer in the program.
+void brianSetIncremental(brianengine *e, bool incremental);
+// statements parsed by the last reload, and reduced by the last run
+int brianParsedCount(brianengine *e);
+int brianReducedCount(brianengine *e);
+
+// Count the rewrites made by each rule and the head symbols of the terms
+// reduced, and write them to a profile file.
+void brianSetProfiling(brianengine *e, bool profiling);
+bool brianWriteProfile(brianengine *e, const char *pathname);
+
+// Reorder the rules of the engine and of its program by a profile, the
+// most used first.  Rules that could match the same term, or build a term
+// the other matches, keep their source order, and no rule moves past a
+// statement.  Returns -1 if the profile cannot be read.
+int brianOrderRules(brianengine *e, const char *pathname);
+
+// Reduce the body of every rule loaded so far, once, with the rules in
+// effect where it is first used, so that runs repeat less work.  A body
+// that does not settle within a small budget is left alone, and no input
+// or output calls are made.  Returns the number of bodies changed.
+int brianPartialEvaluate(brianengine *e);
+
+// Sample what the engine's reductions are doing every interval
+// microseconds of CPU time, by statement, rule and the chain of rewrites
+// that built the node being rewritten, which each node records in its
+// chain field.  Only one engine can be sampled at a time; returns false
+// if another already is.
+bool brianStartSampling(brianengine *e, long interval);
+void brianStopSampling(brianengine *e);
+// Write the samples as folded stacks, the input of flame graph tools.
+bool brianWriteSamples(brianengine *e, const char *pathname);
+
+statementnode *brianStatements(brianengine *e);
+statementnode *brianRules(brianengine *e);
+
+// Parse a single term; the trailing period is optional.  The caller owns
+// the returned term.  Returns NULL on a syntax error.
+astnode *brianParseTerm(brianengine *e, const char *text, long length);
+
+// Reduce a copy of term with the current rule set.  The result is owned
+// by the engine and stays valid until the next reduction.
+astnode *brianReduce(brianengine *e, astnode *term);
+astnode *brianReduceText(brianengine *e, const char *text, long length);
+astnode *brianResult(brianengine *e);
+const char *brianResultText(brianengine *e);
+
+// Start reducing a copy of term; brianContinue then works on it until it
+// is done or budget (which may be NULL) runs out.  The partially reduced
+// term stays valid until the next brianContinue or brianFreeReduction.
+brianreduction *brianStartReduction(brianengine *e, astnode *term);
+brianstatus brianContinue(brianreduction *r, brianbudget *budget);
+astnode *brianReductionTerm(brianreduction *r);
+long brianReductionSteps(brianreduction *r);
+// length in passes of the cycle a reduction stopped on, or 0
+long brianReductionCycle(brianreduction *r);
+void brianFreeReduction(brianreduction *r);
+
+/***********************************************
+ * Compact Term Store
+************************************************/
+
+// Terms kept as parallel arrays of symbol id, type and left and right
+// child, addressed by 32 bit indices: 13 bytes a node with identifiers
+// interned once, instead of a separate allocation per node and string.
+typedef unsigned int termindex;
+#define BRIAN_NIL 0xffffffffu
+
+typedef struct BRIANTERMSTORE briantermstore;
+
+briantermstore *brianCreateStore();
+void brianDestroyStore(briantermstore *s);
+termindex brianStoreTerm(briantermstore *s, astnode *term);
+astnode *brianLoadTerm(briantermstore *s, termindex n);
+// the returned string is allocated and owned by the caller
+char *brianStoreFormula(briantermstore *s, termindex n);
+bool brianStoreMatch(briantermstore *s, termindex term, termindex pattern);
+unsigned int brianStoreNodes(briantermstore *s);
+size_t brianStoreBytes(briantermstore *s);
+
+// Reduce term inside the store with the engine's rules, pass by pass in
+// the same order as brianRun, until a pass changes nothing.  There is no
+// budget or cycle check here.  The store is compacted as garbage builds
+// up, after which the result is the only index into it that is still
+// valid.  Returns BRIAN_NIL if the store runs out of indices.
+termindex brianStoreReduce(brianengine *e, briantermstore *s, termindex term);
+
+// As brianRun, reducing each statement in a term store; input and output
+// calls are left as they are.
+void brianRunCompact(brianengine *e);
+
+#endif
@@ -0,0 +1,3296 @@
+/*********************************
+* Brian
+* Copyright (c) 2023 Brian O'Dell
+*
+**********************************/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "brian.h"
+
+#define PARALLEL_PARSE_THRESHOLD (1L<<20)
+#define MAX_PARSE_THREADS 16
+#define STREAM_BUFFER_SIZE (1L<<20)
+#define READ_CHUNK 4096
+#define PARTIAL_EVAL_STEPS 1000
+#define PARTIAL_EVAL_GROWTH 4
+#define MAX_REWRITE_CHAINS (1<<16)
+#define SAMPLE_SLOTS (1<<14)
+#define MAX_SAMPLE_DEPTH 64
+
+/***********************************************
+ * Structs
+************************************************/
+
+typedef struct UNIFIER{
+  astnode *var;
+  astnode *term;
+  struct UNIFIER *next;
+} unifier;
+
+typedef struct MATCHEDNODE{
+  astnode *node;
+  unifier *unifiers;
+  struct MATCHEDNODE *next;
+} matchednode;
+
+// all parser state lives here so that separate chunks of a
+// program file can be parsed on separate threads
+typedef struct PARSER{
+  const char *text;
+  long length;
+  long offset;
+  long pos;
+  int nodecounter;
+  bool error;
+  int errorcount;
+  char *errors;
+  statementnode *program;
+  statementnode *last;
+  // bytes counted on a parsing thread, for the collecting thread
+  long memory[BRIAN_MEMORY_CATEGORIES];
+} parser;
+
+// An entry of a text keyed table.  Watch mode keeps one table of the
+// statements parsed from each span of program text, with any syntax
+// errors, and one of reduced statements, with the head symbols their
+// reduction touched and the rules those symbols let in.  Profiling
+// counts hits by rule and terms by head symbol.
+typedef struct CACHEENTRY{
+  char *key;
+  statementnode *terms;
+  char *errors;
+  char **symbols;
+  int symbolcount;
+  char *signature;
+  long count;
+  struct CACHEENTRY *next;
+} cacheentry;
+
+typedef struct TERMCACHE{
+  cacheentry **buckets;
+  unsigned int bucketcount;
+  unsigned int count;
+} termcache;
+
+// What a reduction is doing when the sampling profiler's timer fires.
+typedef enum {
+  SAMPLE_IDLE, SAMPLE_MATCH, SAMPLE_REWRITE, SAMPLE_COMPARE, SAMPLE_IO
+} samplephase;
+
+// A chain of rewrites: the rule that built a node, after the chain that
+// built the node it rewrote.  Chain 0 is the term as it was given.
+typedef struct REWRITECHAIN{
+  int parent;
+  astnode *rule;
+} rewritechain;
+
+// Samples with the same statement, chain, rule and phase are counted in
+// one slot of a fixed table that the signal handler never resizes.
+typedef struct SAMPLESLOT{
+  int statement;
+  int chain;
+  astnode *rule;
+  samplephase phase;
+  long count;
+} sampleslot;
+
+// An open file or console stream of an engine; files carry their own
+// large buffer so that chunked reads and writes seldom reach the OS.
+typedef struct BRIANSTREAM{
+  FILE *file;
+  char *buffer;
+  bool writing;
+} brianstream;
+
+struct BRIANENGINE{
+  statementnode *rules;
+  statementnode *program;
+  astnode *result;
+  char *resulttext;
+  char *errors;
+  bool trace;
+  brianbudget budget;
+  brianreduction *suspended;
+  briancyclecheck cyclecheck;
+  int cyclewindow;
+  brianstream *streams;
+  int streamcount;
+  int streamcapacity;
+  // watch mode
+  bool incremental;
+  termcache *sources;
+  termcache *results;
+  statementnode *runrules;
+  int parsedcount;
+  int reducedcount;
+  // profile guided rule ordering
+  bool profiling;
+  termcache *rulehits;
+  termcache *symbolhits;
+  // rule bodies reduced at load time make no input or output calls
+  bool loadtime;
+  // sampling profiler; nodes carry the chain that built them
+  bool sampling;
+  volatile int samplestatement;
+  volatile int samplechain;
+  astnode *volatile samplerule;
+  volatile samplephase samplephase;
+  rewritechain *chains;
+  int *chainbuckets;
+  volatile int chaincount;
+  sampleslot *samples;
+  long sampleslost;
+  long statementmemory;
+  long runmemory;
+  // bytes in use when the current brianRun or brianResume call began,
+  // and added by earlier calls of the same run
+  long runstart;
+  long runused;
+};
+
+// Terms held as parallel arrays addressed by 32 bit indices, with every
+// identifier interned once in a symbol table.  Nodes are never changed
+// once built, so unchanged and matched subterms are shared, not copied.
+struct BRIANTERMSTORE{
+  unsigned int *symbol;
+  unsigned char *type;
+  termindex *left;
+  termindex *right;
+  unsigned int count;
+  unsigned int capacity;
+  // nodes left by the last compaction, and set once the store is full
+  unsigned int livecount;
+  bool full;
+  char **names;
+  unsigned int namecount;
+  unsigned int namecapacity;
+  unsigned int *buckets;
+  unsigned int bucketcount;
+  // engine rules already copied into the store
+  statementnode *lastrule;
+  termindex *rulehead;
+  termindex *rulebody;
+  unsigned int *rulesymbol;
+  int rulecount;
+  // scratch space for the matcher and the reducer
+  unsigned int *bindsymbol;
+  termindex *bindterm;
+  int bindcount;
+  int bindcapacity;
+  termindex *stack;
+  long stacksize;
+  long stackcapacity;
+};
+
+// A reduction in progress.  Everything needed to pick up where a budget
+// ran out is kept here: the pass in progress, the next rule of that pass
+// and any matches of the current rule not yet rewritten.
+struct BRIANREDUCTION{
+  brianengine *engine;
+  astnode *term;
+  statementnode *statement;
+  statementnode *lastrule;
+  statementnode *rule;
+  matchednode *matches;
+  matchednode *nextmatch;
+  // subterms rewritten away by the current rule, freed once its matches
+  // (which may point into them) are done
+  statementnode *orphans;
+  char *passstart;
+  long steps;
+  long nodes;
+  int index;
+  brianstatus status;
+  // hashes of the terms left by recent passes, for cycle detection, and
+  // copies of those terms to confirm a repeat
+  unsigned long long *history;
+  astnode **historyterms;
+  int historycount;
+  int historypos;
+  unsigned long long brenthash;
+  astnode *brentterm;
+  long brentpower;
+  long brentlength;
+  long cyclelength;
+  // head symbols seen, when the result is to be cached under cachekey
+  char *cachekey;
+  char **symbols;
+  int symbolcount;
+  int symbolcapacity;
+  bool io;
+  long rulesteps;
+  // bytes in use when this slice began, and added by earlier slices
+  long memorystart;
+  long memoryused;
+  struct BRIANREDUCTION *next;
+};
+
+/*************************************************
+ * Memory Accounting
+**************************************************/
+
+// Counted per thread, so engines on separate threads only see their own
+// use, in the bytes malloc actually reserved.
+
+__thread brianmemory memoryusage;
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__FreeBSD__)
+#include <malloc_np.h>
+#endif
+
+// the bytes malloc reserved for p; libraries that cannot say count nothing
+long allocationSize(void *p){
+#if defined(__GLIBC__) || defined(__FreeBSD__)
+  return malloc_usable_size(p);
+#elif defined(__APPLE__)
+  return malloc_size(p);
+#else
+  (void)p;
+  return 0;
+#endif
+}
+
+const char *memoryCategoryNames[]={"nodes", "unifiers", "matches", "formulas"};
+
+void *accountMemory(brianmemorycategory category, void *p){
+  if(!p) return p;
+  long size=allocationSize(p);
+  memoryusage.live[category]+=size;
+  if(memoryusage.live[category]>memoryusage.peak[category]){
+    memoryusage.peak[category]=memoryusage.live[category];
+  }
+  memoryusage.total+=size;
+  if(memoryusage.total>memoryusage.totalpeak) memoryusage.totalpeak=memoryusage.total;
+  return p;
+}
+
+void releaseMemory(brianmemorycategory category, void *p){
+  if(!p) return;
+  long size=allocationSize(p);
+  memoryusage.live[category]-=size;
+  memoryusage.total-=size;
+}
+
+void freeMemory(brianmemorycategory category, void *p){
+  releaseMemory(category, p);
+  free(p);
+}
+
+// Moves counts between threads: the thread that allocated gives bytes
+// up with sign -1 and the thread that will free them takes them with +1.
+void moveMemory(long *bytes, int sign){
+  for(int c=0;c<BRIAN_MEMORY_CATEGORIES;c++){
+    memoryusage.live[c]+=sign*bytes[c];
+    memoryusage.total+=sign*bytes[c];
+    if(memoryusage.live[c]>memoryusage.peak[c]) memoryusage.peak[c]=memoryusage.live[c];
+  }
+  if(memoryusage.total>memoryusage.totalpeak) memoryusage.totalpeak=memoryusage.total;
+}
+
+void brianMemoryUsage(brianmemory *usage){
+  *usage=memoryusage;
+}
+
+const char *brianMemoryCategory(brianmemorycategory category){
+  return category<BRIAN_MEMORY_CATEGORIES ? memoryCategoryNames[category] : "unknown";
+}
+
+/*************************************************
+ * Node Creators and Destroyers
+**************************************************/
+
+astnode *createASTLength(const char *identifier, long length, termtype type, int serial){
+  astnode *a=accountMemory(BRIAN_MEMORY_NODES, malloc(sizeof(astnode)));
+  a->type=type;
+  a->identifier=accountMemory(BRIAN_MEMORY_NODES, malloc(length+1));
+  memcpy(a->identifier, identifier, length);
+  a->identifier[length]=0;
+  a->serial=serial;
+  a->chain=0;
+  a->left=NULL;
+  a->right=NULL;
+  return a;
+}
+
+astnode *createAST(char *identifier, termtype type, int serial){
+  return createASTLength(identifier, strlen(identifier), type, serial);
+}
+
+void freeAST(astnode *node){
+  if(!node) return;
+  if(node->left) freeAST(node->left);
+  if(node->right) freeAST(node->right);
+  freeMemory(BRIAN_MEMORY_NODES, node->identifier);
+  freeMemory(BRIAN_MEMORY_NODES, node);
+}
+
+statementnode *createStatement(astnode *stmnt){
+  statementnode *s=malloc(sizeof(statementnode));
+  s->statement=stmnt;
+  s->next=NULL;
+  return s;
+}
+
+void freeStatement(statementnode *stmnt){
+  if(!stmnt) return;
+  statementnode *s=stmnt->next;
+  free(stmnt);
+  while(s){
+    stmnt=s;
+    s=stmnt->next;
+    free(stmnt);
+  }
+}
+
+void freeStatementTerms(statementnode *stmnt){
+  for(statementnode *s=stmnt;s!=NULL;s=s->next){
+    freeAST(s->statement);
+  }
+  freeStatement(stmnt);
+}
+
+unifier *createUnifier(astnode *term, astnode *var){
+  unifier *u=accountMemory(BRIAN_MEMORY_UNIFIERS, malloc(sizeof(unifier)));
+  u->var=var,
+  u->term=term;
+  u->next=NULL;
+  return u;
+}
+
+void freeUnifier(unifier *u){
+  if(!u) return;
+  unifier *u1=u->next;
+  freeMemory(BRIAN_MEMORY_UNIFIERS, u);
+  while(u1){
+    u=u1;
+    u1=u->next;
+    freeMemory(BRIAN_MEMORY_UNIFIERS, u);
+  }
+}
+
+matchednode *createMatchedNode(astnode *node, unifier *u){
+  matchednode *m=accountMemory(BRIAN_MEMORY_MATCHES, malloc(sizeof(matchednode)));
+  m->node=node;
+  m->unifiers=u;
+  m->next=NULL;
+  return m;
+}
+
+void freeMatchedNode(matchednode *m){
+  if(!m) return;
+  matchednode *m1=m->next;
+  freeUnifier(m->unifiers);
+  freeMemory(BRIAN_MEMORY_MATCHES, m);
+  while(m1){
+    m=m1;
+    m1=m->next;
+    freeUnifier(m->unifiers);
+    freeMemory(BRIAN_MEMORY_MATCHES, m);
+  }
+}
+/*************************************************
+ * Stack and List Operations
+**************************************************/
+
+void appendProgram(brianengine *e, statementnode *prog){
+  if(e->program==NULL){
+    e->program=prog;
+  }
+  else {
+    statementnode *p=e->program;
+    while(p->next!=NULL){
+      p=p->next;
+    }
+    p->next=prog;
+  }
+}
+
+void appendStatement(parser *p, statementnode *stmnt){
+  if(p->last==NULL){
+    p->program=stmnt;
+  }
+  else {
+    p->last->next=stmnt;
+  }
+  p->last=stmnt;
+}
+
+void appendRule(brianengine *e, statementnode *rule){
+  if(e->rules==NULL){
+    e->rules=rule;
+  }
+  else {
+    statementnode *r=e->rules;
+    while(r->next!=NULL){
+      r=r->next;
+    }
+    r->next=rule;
+  }
+}
+/**********************************************
+ * Character Classification
+***********************************************/
+
+#define CC_SPACE 1
+#define CC_NEWLINE 2
+#define CC_DELIM 4
+#define CC_QUOTE 8
+#define CC_DIGIT 16
+#define CC_ALPHA 32
+#define CC_OP 64
+#define SCAN_BLOCK_SIZE 32
+
+// one bit per byte of a SCAN_BLOCK_SIZE block for each character class
+typedef struct CHARMASKS{
+  unsigned int space;
+  unsigned int newline;
+  unsigned int delim;
+  unsigned int quote;
+  unsigned int digit;
+  unsigned int alpha;
+  unsigned int op;
+} charmasks;
+
+unsigned char charclass[256];
+void (*classifyBlock)(const char *s, charmasks *m);
+pthread_once_t scannerinit=PTHREAD_ONCE_INIT;
+
+void classifyBlockScalar(const char *s, charmasks *m){
+  memset(m, 0, sizeof(charmasks));
+  for(int k=0;k<SCAN_BLOCK_SIZE;k++){
+    unsigned int bit=1u<<k;
+    unsigned char cc=charclass[(unsigned char)s[k]];
+    if(cc & CC_SPACE) m->space|=bit;
+    if(cc & CC_NEWLINE) m->newline|=bit;
+    if(cc & CC_DELIM) m->delim|=bit;
+    if(cc & CC_QUOTE) m->quote|=bit;
+    if(cc & CC_DIGIT) m->digit|=bit;
+    if(cc & CC_ALPHA) m->alpha|=bit;
+    if(cc & CC_OP) m->op|=bit;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+void classifyHalfSSE2(const char *s, charmasks *m, int shift){
+  __m128i v=_mm_loadu_si128((const __m128i *)s);
+  __m128i newline=_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+  __m128i space=_mm_or_si128(newline, _mm_or_si128(
+    _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+  __m128i delim=_mm_or_si128(
+    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('(')), _mm_cmpeq_epi8(v, _mm_set1_epi8(')'))),
+    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')), _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))));
+  delim=_mm_or_si128(delim, _mm_or_si128(
+    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')), _mm_cmpeq_epi8(v, _mm_set1_epi8('}'))),
+    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')), _mm_cmpeq_epi8(v, _mm_set1_epi8('.')))));
+  delim=_mm_or_si128(delim, _mm_cmpeq_epi8(v, _mm_set1_epi8('#')));
+  __m128i quote=_mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+  // unsigned range checks: x-lo <= hi-lo
+  __m128i d=_mm_sub_epi8(v, _mm_set1_epi8('0'));
+  __m128i digit=_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+  __m128i a=_mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  __m128i alpha=_mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(25)), a);
+  __m128i other=_mm_or_si128(_mm_or_si128(space, delim), _mm_or_si128(quote, _mm_or_si128(digit, alpha)));
+  m->space|=(unsigned int)_mm_movemask_epi8(space)<<shift;
+  m->newline|=(unsigned int)_mm_movemask_epi8(newline)<<shift;
+  m->delim|=(unsigned int)_mm_movemask_epi8(delim)<<shift;
+  m->quote|=(unsigned int)_mm_movemask_epi8(quote)<<shift;
+  m->digit|=(unsigned int)_mm_movemask_epi8(digit)<<shift;
+  m->alpha|=(unsigned int)_mm_movemask_epi8(alpha)<<shift;
+  m->op|=(~(unsigned int)_mm_movemask_epi8(other) & 0xffffu)<<shift;
+}
+
+__attribute__((target("sse2")))
+void classifyBlockSSE2(const char *s, charmasks *m){
+  memset(m, 0, sizeof(charmasks));
+  classifyHalfSSE2(s, m, 0);
+  classifyHalfSSE2(s+16, m, 16);
+}
+
+__attribute__((target("avx2")))
+void classifyBlockAVX2(const char *s, charmasks *m){
+  __m256i v=_mm256_loadu_si256((const __m256i *)s);
+  __m256i newline=_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+  __m256i space=_mm256_or_si256(newline, _mm256_or_si256(
+    _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
+  __m256i delim=_mm256_or_si256(
+    _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')'))),
+    _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']'))));
+  delim=_mm256_or_si256(delim, _mm256_or_si256(
+    _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))),
+    _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')))));
+  delim=_mm256_or_si256(delim, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('#')));
+  __m256i quote=_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+  __m256i d=_mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+  __m256i digit=_mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+  __m256i a=_mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+  __m256i alpha=_mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(25)), a);
+  __m256i other=_mm256_or_si256(_mm256_or_si256(space, delim), _mm256_or_si256(quote, _mm256_or_si256(digit, alpha)));
+  m->space=(unsigned int)_mm256_movemask_epi8(space);
+  m->newline=(unsigned int)_mm256_movemask_epi8(newline);
+  m->delim=(unsigned int)_mm256_movemask_epi8(delim);
+  m->quote=(unsigned int)_mm256_movemask_epi8(quote);
+  m->digit=(unsigned int)_mm256_movemask_epi8(digit);
+  m->alpha=(unsigned int)_mm256_movemask_epi8(alpha);
+  m->op=~(unsigned int)_mm256_movemask_epi8(other);
+}
+#endif
+
+void initCharClasses(){
+  for(int c=0;c<256;c++){
+    unsigned char cc=0;
+    if(c==' ' || c=='\n' || c=='\t') cc|=CC_SPACE;
+    if(c=='\n') cc|=CC_NEWLINE;
+    if(c=='(' || c==')' || c=='[' || c==']' || c=='{' || c=='}'
+     || c==',' || c=='.' || c=='#') cc|=CC_DELIM;
+    if(c=='"') cc|=CC_QUOTE;
+    if(c>='0' && c<='9') cc|=CC_DIGIT;
+    if((c>='a' && c<='z') || (c>='A' && c<='Z')) cc|=CC_ALPHA;
+    if(!cc) cc=CC_OP;
+    charclass[c]=cc;
+  }
+  classifyBlock=classifyBlockScalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")){
+    classifyBlock=classifyBlockAVX2;
+  }
+  else if(__builtin_cpu_supports("sse2")){
+    classifyBlock=classifyBlockSSE2;
+  }
+#endif
+}
+
+void initScanner(){
+  pthread_once(&scannerinit, initCharClasses);
+}
+
+unsigned int selectClasses(charmasks *m, int classes){
+  unsigned int bits=0;
+  if(classes & CC_SPACE) bits|=m->space;
+  if(classes & CC_NEWLINE) bits|=m->newline;
+  if(classes & CC_DELIM) bits|=m->delim;
+  if(classes & CC_QUOTE) bits|=m->quote;
+  if(classes & CC_DIGIT) bits|=m->digit;
+  if(classes & CC_ALPHA) bits|=m->alpha;
+  if(classes & CC_OP) bits|=m->op;
+  return bits;
+}
+
+// Returns the index of the first byte at or after i whose class is
+// (match) or is not (!match) one of classes, or length if none is.
+long scanClasses(const char *s, long i, long length, int classes, bool match){
+  charmasks m;
+  while(i+SCAN_BLOCK_SIZE<=length){
+    classifyBlock(s+i, &m);
+    unsigned int bits=selectClasses(&m, classes);
+    if(!match) bits=~bits;
+    if(bits) return i+__builtin_ctz(bits);
+    i+=SCAN_BLOCK_SIZE;
+  }
+  while(i<length){
+    bool in=(charclass[(unsigned char)s[i]] & classes)!=0;
+    if(in==match) return i;
+    i++;
+  }
+  return length;
+}
+
+long scanWhile(const char *s, long i, long length, int classes){
+  return scanClasses(s, i, length, classes, false);
+}
+
+long scanUntil(const char *s, long i, long length, int classes){
+  return scanClasses(s, i, length, classes, true);
+}
+
+/**********************************************
+ * Abstract Syntax Tree
+***********************************************/
+
+astnode *copydeepASTNode(astnode *node){
+  astnode *copy = createAST(node->identifier, node->type, node->serial);
+  copy->chain=node->chain;
+  if(node->left) copy->left=copydeepASTNode(node->left);
+  if(node->right) copy->right=copydeepASTNode(node->right);
+  return copy;  
+}
+
+void replaceVariable(astnode *term, unifier *u){
+  if(term->left){
+    if(!strcmp(term->left->identifier, u->var->identifier)){
+      freeAST(term->left);
+      term->left=copydeepASTNode(u->term);
+    }
+    else{
+      replaceVariable(term->left, u);
+    }
+  }
+  if(term->right){
+    if(!strcmp(term->right->identifier, u->var->identifier)){
+      freeAST(term->right);
+      term->right=copydeepASTNode(u->term);
+    }
+    else{
+      replaceVariable(term->right, u);
+    }
+  }
+}
+
+bool replaceNode(astnode *node, astnode *match, astnode *replace){
+  if(node->left){
+    if(node->left==match){
+      node->left=replace;
+      return true;
+    }
+    else{
+      if(replaceNode(node->left, match, replace)) return true;
+    }
+  }
+  if(node->right){
+    if(node->right==match){
+      node->right=replace;
+      return true;
+    }
+    else{
+      if(replaceNode(node->right, match, replace)) return true;
+    }
+  }
+  return false;
+}
+
+bool equivalent(astnode *term, astnode *rulehead){
+  bool left=true;
+  bool right=true;
+  if(rulehead->type==VARIABLE) return true;
+  if(term->type!=rulehead->type) return false;
+  if(strcmp(term->identifier,rulehead->identifier)) return false;
+  if(term->left!=NULL){
+    if(rulehead->left==NULL) return false;
+    left=equivalent(term->left, rulehead->left);
+  }
+  else if(rulehead->left!=NULL){
+    return false;
+  }
+  if(term->right!=NULL){
+    if(rulehead->right==NULL) return false;
+    right=equivalent(term->right, rulehead->right);
+  }
+  else if(rulehead->right!=NULL){
+    return false;
+  }
+  return left && right;
+}
+
+bool sameTerm(astnode *a, astnode *b){
+  if(a==b) return true;
+  if(!a || !b) return false;
+  if(a->type!=b->type || strcmp(a->identifier, b->identifier)) return false;
+  return sameTerm(a->left, b->left) && sameTerm(a->right, b->right);
+}
+
+// The symbol a term is dispatched on: the function name of an
+// application such as cons@(A,B), otherwise the root identifier.
+const char *headSymbol(astnode *term){
+  if(term->type==BINARYOP && !strcmp(term->identifier, "@")
+  && term->left && term->left->type==CONSTANT){
+    return term->left->identifier;
+  }
+  return term->identifier;
+}
+
+// true for a head that can match terms of any head symbol: a variable,
+// or an application whose function is not a constant, such as F@Y
+bool matchesAnySymbol(astnode *head){
+  if(head->type==VARIABLE) return true;
+  return head->type==BINARYOP && !strcmp(head->identifier, "@")
+    && head->left && head->left->type!=CONSTANT;
+}
+
+unifier *unify(astnode *term, astnode *rulenode){
+  if(rulenode->type==VARIABLE) return(createUnifier(term, rulenode));
+  if(strcmp(term->identifier, rulenode->identifier)) return NULL;
+  if(term->type!=rulenode->type) return NULL;
+  unifier *u=NULL;
+  if(term->left){
+    if(!rulenode->left) return NULL;
+    unifier *left=unify(term->left, rulenode->left);
+    if(left) u=left;
+  }
+  else if(rulenode->left){
+    return NULL;
+  }
+  if(term->right){
+    if(!rulenode->right) return NULL;
+    unifier *right=unify(term->right, rulenode->right);
+    if(right){
+      if(u){
+        unifier *u1=u;
+        while(u1->next){
+          u1=u1->next;
+        }
+        u1->next=right;
+      }
+      else{
+        u=right;
+      }
+    }
+  }
+  else if(rulenode->right){
+    return NULL;
+  }
+  return u;
+}
+
+matchednode *resolve(astnode *term, astnode *rulehead){
+  matchednode *m=NULL;
+  if(equivalent(term, rulehead)){
+    m=createMatchedNode(term, unify(term, rulehead));
+  }
+  if(term->left){
+    matchednode *l=resolve(term->left, rulehead);
+    if(l){
+      if(m){
+        m->next=l;
+      }
+      else{
+        m=l;
+      }
+    }
+  }
+  if(term->right){
+    matchednode *r=resolve(term->right, rulehead);
+    if(r){
+      if(m){
+        matchednode *m1=m;
+        while(m1->next){
+          m1=m1->next;
+        }
+        m1->next=r;
+      }
+      else{
+        m=r;
+      }
+    }
+  }
+  return m;
+}
+
+char *formulaText(astnode *ast, bool paren){
+  bool application=false;
+  char begin[2]="\0\0";
+  char end[2]="\0\0";
+  char *left=NULL;
+  char *mid=NULL;
+  char *right=NULL;
+  switch (ast->type)
+  {
+  case BINARYOP:
+  case IMPLY:
+    if(ast->identifier[0]=='@' && ast->identifier[1]==0) application=true;
+    if(paren && ast->identifier[0]!=','){
+      begin[0]='(';
+    }
+    left=formulaText(ast->left, true);
+    mid=ast->identifier;
+    right=formulaText(ast->right, true);
+    if(paren && ast->identifier[0]!=','){
+      end[0]=')';
+    }
+    break;
+  case VARIABLE:
+  case CONSTANT:
+  case NUMBER:
+    mid=ast->identifier;
+    break;
+  case BRACKET:
+    begin[0]='[';
+    if(ast->right) right=formulaText(ast->right, false);
+    end[0]=']';
+    break;
+  case CURLY:
+    begin[0]='{';
+    if(ast->right) right=formulaText(ast->right, false);
+    end[0]='}';
+    break;
+  
+  default:
+    break;
+  }
+
+  int len=1;
+  if(begin[0]!=0) len+=1;
+  if(left!=NULL) len+=strlen(left);
+  len+=strlen(ast->identifier);
+  if(application) len+=2;
+  if(right!=NULL) len+=strlen(right);
+  if(end[0]!=0) len+=1;
+  char *formula=accountMemory(BRIAN_MEMORY_FORMULAS, calloc(1, len));
+  if(begin[0]!=0) strcat(formula, begin);
+  if(left!=NULL) strcat(formula, left);
+  if(mid!=NULL) strcat(formula, mid);
+  if(application) strcat(formula, "(");
+  if(right!=NULL) strcat(formula, right);
+  if(application) strcat(formula, ")");
+  if(end[0]!=0) strcat(formula, end);
+  freeMemory(BRIAN_MEMORY_FORMULAS, left);
+  freeMemory(BRIAN_MEMORY_FORMULAS, right);
+  return formula;
+}
+
+// a formula handed to the caller is no longer the library's to count
+char *getFormula(astnode *ast, bool paren){
+  char *formula=formulaText(ast, paren);
+  releaseMemory(BRIAN_MEMORY_FORMULAS, formula);
+  return formula;
+}
+
+/**********************************************
+ * Parser
+***********************************************/
+
+// A single recursive descent pass over the program text builds astnodes
+// directly, following the EBNF in the README.  All binary operators share
+// one precedence level and are left associative, except the comma which
+// is right associative; parenthesis establish any other grouping.
+
+// appends a formatted line to an allocated message buffer
+void appendMessage(char **messages, const char *format, ...){
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  size_t used=*messages ? strlen(*messages) : 0;
+  *messages=realloc(*messages, used+strlen(line)+2);
+  strcpy(*messages+used, line);
+  strcat(*messages, "\n");
+}
+
+// appends text that already ends in a newline, however long
+void appendText(char **messages, const char *text){
+  size_t used=*messages ? strlen(*messages) : 0;
+  size_t length=strlen(text);
+  *messages=realloc(*messages, used+length+1);
+  memcpy(*messages+used, text, length+1);
+}
+
+void syntaxError(parser *p, const char *message){
+  if(p->error) return;
+  // count lines from the start of the whole file, not just this chunk
+  const char *file=p->text-p->offset;
+  int line=1;
+  for(long k=0;k<p->offset+p->pos && k<p->offset+p->length;k++){
+    if(file[k]=='\n') line++;
+  }
+  appendMessage(&p->errors, "Syntax error on line %d: %s", line, message);
+  p->errorcount++;
+  p->error=true;
+}
+
+char peekChar(parser *p){
+  return p->pos<p->length ? p->text[p->pos] : 0;
+}
+
+char peekNextChar(parser *p){
+  return p->pos+1<p->length ? p->text[p->pos+1] : 0;
+}
+
+void skipSpace(parser *p){
+  while(true){
+    p->pos=scanWhile(p->text, p->pos, p->length, CC_SPACE);
+    if(peekChar(p)!='#') return;
+    p->pos=scanUntil(p->text, p->pos, p->length, CC_NEWLINE);
+  }
+}
+
+bool isClass(char c, int classes){
+  return (charclass[(unsigned char)c] & classes)!=0;
+}
+
+astnode *parseTerm(parser *p);
+
+// strings become comma delimited lists of single character constants
+astnode *parseString(parser *p){
+  long start=p->pos+1;
+  long close=scanUntil(p->text, start, p->length, CC_QUOTE);
+  astnode *list=createAST("[", BRACKET, p->nodecounter++);
+  astnode **tail=&list->right;
+  for(long k=start;k<close;k++){
+    astnode *character=createASTLength(p->text+k, 1, CONSTANT, p->nodecounter++);
+    if(k+1<close){
+      astnode *comma=createAST(",", BINARYOP, p->nodecounter++);
+      comma->left=character;
+      *tail=comma;
+      tail=&comma->right;
+    }
+    else {
+      *tail=character;
+    }
+  }
+  p->pos=close<p->length ? close+1 : p->length;
+  return list;
+}
+
+astnode *parseList(parser *p, termtype type, char open, char close){
+  char id[2]={open, 0};
+  astnode *list=createAST(id, type, p->nodecounter++);
+  p->pos++;
+  skipSpace(p);
+  if(peekChar(p)!=close){
+    list->right=parseTerm(p);
+    skipSpace(p);
+  }
+  if(!p->error && peekChar(p)!=close){
+    syntaxError(p, close==']' ? "expected ']'" : "expected '}'");
+  }
+  if(p->error){
+    freeAST(list);
+    return NULL;
+  }
+  p->pos++;
+  return list;
+}
+
+astnode *parseNumberOrConstant(parser *p){
+  long start=p->pos;
+  if(peekChar(p)=='-') p->pos++;
+  p->pos=scanWhile(p->text, p->pos, p->length, CC_DIGIT);
+  if(isClass(peekChar(p), CC_ALPHA) && p->text[start]!='-'){
+    p->pos=scanWhile(p->text, p->pos, p->length, CC_ALPHA | CC_DIGIT);
+    return createASTLength(p->text+start, p->pos-start, CONSTANT, p->nodecounter++);
+  }
+  if(peekChar(p)=='.' && isClass(peekNextChar(p), CC_DIGIT)){
+    p->pos=scanWhile(p->text, p->pos+1, p->length, CC_DIGIT);
+  }
+  return createASTLength(p->text+start, p->pos-start, NUMBER, p->nodecounter++);
+}
+
+astnode *parsePrimary(parser *p){
+  skipSpace(p);
+  char c=peekChar(p);
+  if(c=='('){
+    p->pos++;
+    astnode *term=parseTerm(p);
+    if(p->error) return NULL;
+    skipSpace(p);
+    if(peekChar(p)!=')'){
+      syntaxError(p, "expected ')'");
+      freeAST(term);
+      return NULL;
+    }
+    p->pos++;
+    return term;
+  }
+  if(c=='[') return parseList(p, BRACKET, '[', ']');
+  if(c=='{') return parseList(p, CURLY, '{', '}');
+  if(c=='"') return parseString(p);
+  if(isClass(c, CC_DIGIT) || (c=='-' && isClass(peekNextChar(p), CC_DIGIT))){
+    return parseNumberOrConstant(p);
+  }
+  if(isClass(c, CC_ALPHA)){
+    long start=p->pos;
+    p->pos=scanWhile(p->text, p->pos, p->length, CC_ALPHA | CC_DIGIT);
+    termtype type=isupper(c) ? VARIABLE : CONSTANT;
+    return createASTLength(p->text+start, p->pos-start, type, p->nodecounter++);
+  }
+  syntaxError(p, "expected a term");
+  return NULL;
+}
+
+// Returns the binary operator at the current position, consuming it, or
+// NULL if the next character cannot start an operator.
+astnode *parseOperator(parser *p){
+  skipSpace(p);
+  char c=peekChar(p);
+  if(c==','){
+    p->pos++;
+    return createAST(",", BINARYOP, p->nodecounter++);
+  }
+  if(c=='-' && peekNextChar(p)=='>'){
+    p->pos+=2;
+    return createAST("->", IMPLY, p->nodecounter++);
+  }
+  if(p->pos<p->length && isClass(c, CC_OP)){
+    long start=p->pos;
+    p->pos=scanWhile(p->text, p->pos, p->length, CC_OP);
+    return createASTLength(p->text+start, p->pos-start, BINARYOP, p->nodecounter++);
+  }
+  return NULL;
+}
+
+typedef struct NODESTACK{
+  astnode **items;
+  int count;
+  int capacity;
+} nodestack;
+
+void pushNode(nodestack *s, astnode *node){
+  if(s->count==s->capacity){
+    s->capacity=s->capacity ? s->capacity*2 : 8;
+    s->items=realloc(s->items, sizeof(astnode *)*s->capacity);
+  }
+  s->items[s->count++]=node;
+}
+
+// joins the last operator to the last two operands
+void reduceOperator(nodestack *operands, nodestack *operators){
+  astnode *op=operators->items[--operators->count];
+  op->right=operands->items[--operands->count];
+  op->left=operands->items[--operands->count];
+  operands->items[operands->count++]=op;
+}
+
+// Operators share one precedence level, grouped as the shunting-yard
+// parser grouped them: a comma groups right with the commas before it
+// and closes everything else to its left, and any other operator takes
+// only the last operator before it.  So a,b,c is a,(b,c), a@b,c is
+// (a@b),c, and a,b->c is (a,b)->c.
+astnode *parseTerm(parser *p){
+  nodestack operands={NULL, 0, 0};
+  nodestack operators={NULL, 0, 0};
+  astnode *term=parsePrimary(p);
+  if(term) pushNode(&operands, term);
+  while(!p->error){
+    astnode *op=parseOperator(p);
+    if(!op) break;
+    if(op->identifier[0]==','){
+      bool aftercomma=operators.count && operators.items[operators.count-1]->identifier[0]==',';
+      while(!aftercomma && operators.count) reduceOperator(&operands, &operators);
+    }
+    else if(operators.count){
+      reduceOperator(&operands, &operators);
+    }
+    pushNode(&operators, op);
+    term=parsePrimary(p);
+    if(term) pushNode(&operands, term);
+  }
+  term=NULL;
+  if(p->error){
+    for(int k=0;k<operands.count;k++) freeAST(operands.items[k]);
+    for(int k=0;k<operators.count;k++) freeAST(operators.items[k]);
+  }
+  else {
+    while(operators.count) reduceOperator(&operands, &operators);
+    term=operands.items[0];
+  }
+  free(operands.items);
+  free(operators.items);
+  return term;
+}
+
+// Returns the index just past the first statement-ending period at or
+// after target, scanning from i (which must itself be a statement
+// boundary) so that quoted strings and comments are skipped correctly.
+// A period between two digits is a decimal point, not a statement end.
+long nextStatementBoundary(const char *text, long i, long length, long target){
+  while((i=scanUntil(text, i, length, CC_DELIM | CC_QUOTE))<length){
+    char c=text[i];
+    if(c=='#'){
+      i=scanUntil(text, i, length, CC_NEWLINE);
+    }
+    else if(c=='"'){
+      i=scanUntil(text, i+1, length, CC_QUOTE);
+    }
+    else if(c=='.'){
+      bool decimal=i>0 && isdigit(text[i-1]) && i+1<length && isdigit(text[i+1]);
+      if(!decimal && i>=target) return i+1;
+    }
+    i++;
+  }
+  return length;
+}
+
+// Parses every statement in the parser's text onto its program list.
+// A statement with a syntax error is reported and skipped.
+void parseText(parser *p){
+  while(true){
+    skipSpace(p);
+    if(p->pos>=p->length) return;
+    p->nodecounter=0;
+    p->error=false;
+    astnode *term=parseTerm(p);
+    if(!p->error){
+      skipSpace(p);
+      if(peekChar(p)=='.'){
+        p->pos++;
+        appendStatement(p, createStatement(term));
+        continue;
+      }
+      syntaxError(p, "expected '.'");
+      freeAST(term);
+    }
+    p->pos=nextStatementBoundary(p->text, p->pos, p->length, p->pos);
+  }
+}
+
+/*********************************************************
+ * Parallel Parsing
+**********************************************************/
+
+parser *createParser(const char *text, long length, long offset){
+  parser *p=calloc(1, sizeof(parser));
+  p->text=text;
+  p->length=length;
+  p->offset=offset;
+  return p;
+}
+
+// hands a finished parser's statements and errors to the engine
+int collectParser(brianengine *e, parser *p){
+  int errorcount=p->errorcount;
+  moveMemory(p->memory, 1);
+  if(p->program) appendProgram(e, p->program);
+  if(p->errors) appendText(&e->errors, p->errors);
+  free(p->errors);
+  free(p);
+  return errorcount;
+}
+
+void *parseChunk(void *arg){
+  parser *p=arg;
+  long before[BRIAN_MEMORY_CATEGORIES];
+  memcpy(before, memoryusage.live, sizeof(before));
+  parseText(p);
+  for(int c=0;c<BRIAN_MEMORY_CATEGORIES;c++) p->memory[c]=memoryusage.live[c]-before[c];
+  moveMemory(p->memory, -1);
+  return NULL;
+}
+
+// Large files are split at top level statement boundaries and each
+// chunk is parsed on its own thread; the resulting
+// statement lists are appended to the program in file order.
+int parseMemFile(brianengine *e, const char *text, long length){
+  initScanner();
+  long nthreads=sysconf(_SC_NPROCESSORS_ONLN);
+  if(nthreads>MAX_PARSE_THREADS) nthreads=MAX_PARSE_THREADS;
+  if(length<PARALLEL_PARSE_THRESHOLD || nthreads<2){
+    parser *p=createParser(text, length, 0);
+    parseText(p);
+    return collectParser(e, p);
+  }
+  parser *chunks[MAX_PARSE_THREADS];
+  pthread_t threads[MAX_PARSE_THREADS];
+  bool started[MAX_PARSE_THREADS];
+  int nchunks=0;
+  long start=0;
+  while(start<length && nchunks<nthreads){
+    long end=length;
+    if(nchunks<nthreads-1){
+      end=nextStatementBoundary(text, start, length, start+length/nthreads);
+    }
+    parser *p=createParser(text+start, end-start, start);
+    chunks[nchunks]=p;
+    started[nchunks]=!pthread_create(&threads[nchunks], NULL, parseChunk, p);
+    if(!started[nchunks]) parseChunk(p);
+    nchunks++;
+    start=end;
+  }
+  int errorcount=0;
+  for(int k=0;k<nchunks;k++){
+    if(started[k]) pthread_join(threads[k], NULL);
+    errorcount+=collectParser(e, chunks[k]);
+  }
+  return errorcount;
+}
+
+/*********************************************************
+ * FILE I/O 
+**********************************************************/
+long getFileSize(const char *pathname){
+  long sz;
+  FILE *f;
+
+  f = fopen(pathname, "r");
+  if(f == NULL) return 0;
+  fseek(f, 0L, SEEK_END);
+  sz = ftell(f);
+  fclose(f);
+  return sz;
+}
+
+char *loadMemFile(const char *pathname, long *length){
+  char c;
+  long sz = getFileSize(pathname);
+  long i = 0;
+  char *memfile = malloc(sz+1);
+  if(memfile == NULL) return NULL;
+  FILE *f = fopen(pathname, "r");
+  if(f == NULL){
+    free(memfile);
+    return NULL;
+  }
+  do
+  {
+    c = fgetc(f);
+    memfile[i++] = c;
+  } while (c != EOF && i <= sz);
+  
+  fclose(f);
+  *length = sz;
+  return memfile;
+}
+
+/*********************************************************
+ * Reduction
+**********************************************************/
+
+void traceFormula(const char *label, astnode *ast){
+  char *f=formulaText(ast, false);
+  printf("%s%s.\n", label, f);
+  freeMemory(BRIAN_MEMORY_FORMULAS, f);
+}
+
+long countNodes(astnode *node){
+  if(!node) return 0;
+  return 1+countNodes(node->left)+countNodes(node->right);
+}
+
+// A structural hash of term; equal terms always hash alike.
+unsigned long long hashTerm(astnode *term){
+  unsigned long long h=1469598103934665603ULL;
+  if(!term) return h;
+  h=(h^(unsigned long long)term->type)*1099511628211ULL;
+  for(const char *c=term->identifier;*c;c++){
+    h=(h^(unsigned char)*c)*1099511628211ULL;
+  }
+  h=(h^hashTerm(term->left))*1099511628211ULL;
+  h=(h^(hashTerm(term->right)+0x9e3779b97f4a7c15ULL))*1099511628211ULL;
+  return h;
+}
+
+// Records the term left by a pass and returns true if it repeats an
+// earlier one, setting the cycle length in passes.  The window check
+// remembers the last cyclewindow states and stops on the first repeat;
+// Brent's check keeps one state and finds a cycle of any length within
+// a few times its length.  States are found by hash, and a copy of each
+// remembered term confirms the repeat, so a collision cannot end the
+// reduction.
+bool revisitsState(brianreduction *r){
+  brianengine *e=r->engine;
+  unsigned long long h=hashTerm(r->term);
+  if(e->cyclecheck==BRIAN_CYCLES_WINDOW && e->cyclewindow>0){
+    if(!r->history){
+      r->history=calloc(e->cyclewindow, sizeof(unsigned long long));
+      r->historyterms=calloc(e->cyclewindow, sizeof(astnode *));
+    }
+    for(int k=0;k<r->historycount;k++){
+      int slot=(r->historypos-1-k+e->cyclewindow)%e->cyclewindow;
+      if(r->history[slot]==h && sameTerm(r->historyterms[slot], r->term)){
+        r->cyclelength=k+1;
+        return true;
+      }
+    }
+    r->history[r->historypos]=h;
+    freeAST(r->historyterms[r->historypos]);
+    r->historyterms[r->historypos]=copydeepASTNode(r->term);
+    r->historypos=(r->historypos+1)%e->cyclewindow;
+    if(r->historycount<e->cyclewindow) r->historycount++;
+  }
+  else if(e->cyclecheck==BRIAN_CYCLES_BRENT){
+    if(!r->brentpower){
+      r->brenthash=h;
+      freeAST(r->brentterm);
+      r->brentterm=copydeepASTNode(r->term);
+      r->brentpower=1;
+      r->brentlength=0;
+      return false;
+    }
+    r->brentlength++;
+    if(h==r->brenthash && sameTerm(r->brentterm, r->term)){
+      r->cyclelength=r->brentlength;
+      return true;
+    }
+    if(r->brentlength==r->brentpower){
+      r->brenthash=h;
+      freeAST(r->brentterm);
+      r->brentterm=copydeepASTNode(r->term);
+      r->brentpower*=2;
+      r->brentlength=0;
+    }
+  }
+  return false;
+}
+
+void forgetStates(brianreduction *r){
+  for(int k=0;k<r->historycount;k++){
+    freeAST(r->historyterms[k]);
+    r->historyterms[k]=NULL;
+  }
+  freeAST(r->brentterm);
+  r->brentterm=NULL;
+  r->historycount=0;
+  r->historypos=0;
+  r->brentpower=0;
+}
+
+long elapsedMillis(struct timespec *start){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec-start->tv_sec)*1000+(now.tv_nsec-start->tv_nsec)/1000000;
+}
+
+void noteSymbols(brianreduction *r, astnode *term);
+void markChain(astnode *term, int chain);
+int findChain(brianengine *e, int parent, astnode *rule);
+
+// Reduces prog in place with the rules the engine has so far.  Rules
+// added later are not seen, even if the reduction is resumed after them.
+brianreduction *createReduction(brianengine *e, astnode *prog, statementnode *statement){
+  brianreduction *r=calloc(1, sizeof(brianreduction));
+  r->engine=e;
+  r->term=prog;
+  r->statement=statement;
+  r->lastrule=e->rules;
+  while(r->lastrule && r->lastrule->next) r->lastrule=r->lastrule->next;
+  r->nodes=countNodes(prog);
+  r->status=BRIAN_SUSPENDED;
+  if(e->incremental){
+    r->cachekey=formulaText(prog, false);
+    noteSymbols(r, prog);
+  }
+  if(e->sampling) markChain(prog, 0);
+  if(e->cyclecheck!=BRIAN_CYCLES_OFF) revisitsState(r);
+  return r;
+}
+
+void applyMatch(brianreduction *r, astnode *rule, matchednode *mnx){
+  brianengine *e=r->engine;
+  e->samplephase=SAMPLE_REWRITE;
+  e->samplechain=mnx->node->chain;
+  // every match gets its own copy of the rule body
+  astnode *rulebody=copydeepASTNode(rule->right);
+  if(e->sampling) markChain(rulebody, findChain(e, mnx->node->chain, rule));
+  unifier *u=mnx->unifiers;
+  while(u){
+    if(!strcmp(rulebody->identifier, u->var->identifier)){
+      freeAST(rulebody);
+      rulebody=copydeepASTNode(u->term);
+    }
+    else{
+      replaceVariable(rulebody, u);
+    }
+    u=u->next;
+  }
+  if(r->engine->trace){
+    traceFormula("Statement - ", r->term);
+    traceFormula("  Rule - ", rule);
+    traceFormula("    Matched Node - ", mnx->node);
+    traceFormula("      Transformed Node - ", rulebody);
+  }
+  if(mnx->node==r->term){
+    r->term=rulebody;
+  }
+  else if(!replaceNode(r->term, mnx->node, rulebody)){
+    // the match lay inside a subterm this rule has already rewritten
+    freeAST(rulebody);
+    return;
+  }
+  r->nodes+=countNodes(rulebody)-countNodes(mnx->node);
+  if(r->cachekey) noteSymbols(r, rulebody);
+  statementnode *orphan=createStatement(mnx->node);
+  orphan->next=r->orphans;
+  r->orphans=orphan;
+  r->steps++;
+}
+
+// true once the reduction has grown the bytes in use past the
+// statement's limit, or the engine's run has grown them past the run's.
+// Only growth since the run began counts, so memory other engines on the
+// thread hold is not charged to this one.
+bool memoryExceeded(brianreduction *r){
+  brianengine *e=r->engine;
+  long used=r->memoryused+memoryusage.total-r->memorystart;
+  if(e->statementmemory && used>e->statementmemory) return true;
+  return e->runmemory && e->runused+memoryusage.total-e->runstart>e->runmemory;
+}
+
+bool applyPrimitives(brianreduction *r, astnode **slot);
+void countRuleHits(brianengine *e, astnode *rule, long hits);
+void countSymbols(brianengine *e, astnode *term);
+
+// Applies rules until a pass leaves the term unchanged, or until one of
+// the limits in budget (if any) is reached before the next rewrite.
+brianstatus reduceSlice(brianreduction *r, brianbudget *budget){
+  struct timespec start;
+  brianengine *e=r->engine;
+  long steps=0;
+  if(r->status==BRIAN_DONE || r->status==BRIAN_CYCLE || r->status==BRIAN_MEMORY_EXHAUSTED){
+    return r->status;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  e->samplestatement=r->index;
+  while(true){
+    if(!r->passstart){
+      e->samplechain=0;
+      e->samplephase=SAMPLE_COMPARE;
+      r->passstart=formulaText(r->term, false);
+      r->rule=r->lastrule ? r->engine->rules : NULL;
+      // after input or output the term is a new state whatever its shape
+      if(!r->engine->loadtime && applyPrimitives(r, &r->term)) forgetStates(r);
+      if(r->engine->profiling) countSymbols(r->engine, r->term);
+    }
+    while(r->rule!=NULL){
+      astnode *rule=r->rule->statement;
+      e->samplerule=rule;
+      e->samplechain=0;
+      if(rule && !r->matches){
+        e->samplephase=SAMPLE_MATCH;
+        r->matches=resolve(r->term, rule->left);
+        r->nextmatch=r->matches;
+        r->rulesteps=r->steps;
+      }
+      while(r->nextmatch){
+        if(budget){
+          if(budget->maxsteps && steps>=budget->maxsteps) return r->status=BRIAN_STEPS_EXHAUSTED;
+          if(budget->maxnodes && r->nodes>budget->maxnodes) return r->status=BRIAN_NODES_EXHAUSTED;
+          if(budget->maxmillis && elapsedMillis(&start)>=budget->maxmillis) return r->status=BRIAN_TIME_EXHAUSTED;
+        }
+        if(memoryExceeded(r)) return r->status=BRIAN_MEMORY_EXHAUSTED;
+        applyMatch(r, rule, r->nextmatch);
+        r->nextmatch=r->nextmatch->next;
+        steps++;
+      }
+      if(r->engine->profiling && r->steps>r->rulesteps){
+        countRuleHits(r->engine, rule, r->steps-r->rulesteps);
+      }
+      freeMatchedNode(r->matches);
+      r->matches=NULL;
+      freeStatementTerms(r->orphans);
+      r->orphans=NULL;
+      r->rulesteps=r->steps;
+      r->rule=r->rule==r->lastrule ? NULL : r->rule->next;
+    }
+    // compares belong to the pass, not to the last rewrite's chain
+    e->samplechain=0;
+    e->samplerule=NULL;
+    e->samplephase=SAMPLE_COMPARE;
+    char *passend=formulaText(r->term, false);
+    bool changed=strcmp(r->passstart, passend)!=0;
+    freeMemory(BRIAN_MEMORY_FORMULAS, r->passstart);
+    freeMemory(BRIAN_MEMORY_FORMULAS, passend);
+    r->passstart=NULL;
+    if(!changed) return r->status=BRIAN_DONE;
+    if(r->engine->cyclecheck!=BRIAN_CYCLES_OFF && revisitsState(r)){
+      return r->status=BRIAN_CYCLE;
+    }
+  }
+}
+
+// Each slice is charged only for what it adds to the bytes in use, so
+// memory other statements take while this one is suspended is not
+// counted against it.
+brianstatus continueReduction(brianreduction *r, brianbudget *budget){
+  r->memorystart=memoryusage.total;
+  brianstatus status=reduceSlice(r, budget);
+  r->memoryused+=memoryusage.total-r->memorystart;
+  return status;
+}
+
+void freeReduction(brianreduction *r){
+  freeMatchedNode(r->matches);
+  freeStatementTerms(r->orphans);
+  for(int k=0;k<r->symbolcount;k++) free(r->symbols[k]);
+  free(r->symbols);
+  freeMemory(BRIAN_MEMORY_FORMULAS, r->cachekey);
+  forgetStates(r);
+  free(r->history);
+  free(r->historyterms);
+  freeMemory(BRIAN_MEMORY_FORMULAS, r->passstart);
+  free(r);
+}
+
+// replaces the term of a reduction stopped for memory
+void abortTerm(brianreduction *r){
+  freeAST(r->term);
+  r->term=createAST("aborted", CONSTANT, 0);
+}
+
+// Applies the engine's rules to prog until a pass leaves it unchanged,
+// or until cycle detection finds it repeating.
+astnode *reduceStatement(brianengine *e, astnode *prog){
+  brianreduction *r=createReduction(e, prog, NULL);
+  brianstatus status=continueReduction(r, NULL);
+  e->samplephase=SAMPLE_IDLE;
+  if(status==BRIAN_CYCLE){
+    appendMessage(&e->errors, "Reduction stopped after %ld steps: cycle of %ld passes",
+      r->steps, r->cyclelength);
+  }
+  if(status==BRIAN_MEMORY_EXHAUSTED){
+    appendMessage(&e->errors, "Reduction aborted after %ld steps: memory limit exceeded", r->steps);
+    abortTerm(r);
+  }
+  prog=r->term;
+  freeReduction(r);
+  return prog;
+}
+
+const char *budgetMessage(brianstatus status){
+  switch (status)
+  {
+  case BRIAN_STEPS_EXHAUSTED:
+    return "step budget exhausted";
+  case BRIAN_NODES_EXHAUSTED:
+    return "node budget exhausted";
+  case BRIAN_TIME_EXHAUSTED:
+    return "time budget exhausted";
+  default:
+    return "suspended";
+  }
+}
+
+/*********************************************************
+ * Input and Output
+**********************************************************/
+
+// Streams are numbered terms: 0, 1 and 2 are the console, files opened
+// by a program take the lowest free number after them.  The primitives
+//   open@Name  create@Name  append@Name         a stream number, or error
+//   read@S  read@(S,N)                          up to N characters, or eof
+//   readline@S                                  the next line, or eof
+//   write@(S,T)                                 S, once T is written
+//   close@S                                     closed
+// are made at the start of each pass, innermost first and left to right,
+// once their arguments are fully reduced.  Text is read and written as
+// strings, lists of single characters.
+
+const char *primitiveNames[]={
+  "open", "create", "append", "read", "readline", "write", "close", NULL
+};
+
+// Standard output gets the same large buffer as files once, for the
+// whole process, before the first engine writes to it.  A terminal stays
+// line buffered so output still shows up as it is written.
+char consolebuffer[STREAM_BUFFER_SIZE];
+pthread_once_t consoleinit=PTHREAD_ONCE_INIT;
+
+void bufferConsole(){
+  if(!isatty(fileno(stdout))) setvbuf(stdout, consolebuffer, _IOFBF, STREAM_BUFFER_SIZE);
+}
+
+void openConsole(brianengine *e){
+  if(e->streams) return;
+  e->streamcapacity=8;
+  e->streams=calloc(e->streamcapacity, sizeof(brianstream));
+  e->streams[0].file=stdin;
+  e->streams[1].file=stdout;
+  e->streams[1].writing=true;
+  e->streams[2].file=stderr;
+  e->streams[2].writing=true;
+  e->streamcount=3;
+}
+
+int openStream(brianengine *e, const char *pathname, const char *mode){
+  FILE *f=fopen(pathname, mode);
+  if(f==NULL) return -1;
+  openConsole(e);
+  int k=3;
+  while(k<e->streamcount && e->streams[k].file) k++;
+  if(k==e->streamcount){
+    if(e->streamcount==e->streamcapacity){
+      e->streamcapacity*=2;
+      e->streams=realloc(e->streams, sizeof(brianstream)*e->streamcapacity);
+    }
+    e->streamcount++;
+  }
+  brianstream *s=&e->streams[k];
+  s->file=f;
+  s->buffer=malloc(STREAM_BUFFER_SIZE);
+  setvbuf(f, s->buffer, _IOFBF, STREAM_BUFFER_SIZE);
+  s->writing=mode[0]!='r';
+  return k;
+}
+
+brianstream *findStream(brianengine *e, astnode *handle){
+  char *end;
+  openConsole(e);
+  if(handle->type!=NUMBER) return NULL;
+  long k=strtol(handle->identifier, &end, 10);
+  if(*end || k<0 || k>=e->streamcount || !e->streams[k].file) return NULL;
+  return &e->streams[k];
+}
+
+// the console is only flushed, never closed
+void closeStream(brianstream *s){
+  if(s->file==stdin || s->file==stdout || s->file==stderr){
+    fflush(s->file);
+    return;
+  }
+  fclose(s->file);
+  free(s->buffer);
+  s->file=NULL;
+  s->buffer=NULL;
+}
+
+void closeStreams(brianengine *e){
+  for(int k=0;k<e->streamcount;k++){
+    if(e->streams[k].file) closeStream(&e->streams[k]);
+  }
+  free(e->streams);
+  e->streams=NULL;
+  e->streamcount=0;
+}
+
+// the same list of single character constants parseString builds
+astnode *createString(const char *text, long length){
+  astnode *list=createAST("[", BRACKET, 0);
+  astnode **tail=&list->right;
+  for(long k=0;k<length;k++){
+    astnode *character=createASTLength(text+k, 1, CONSTANT, 0);
+    if(k+1<length){
+      astnode *comma=createAST(",", BINARYOP, 0);
+      comma->left=character;
+      *tail=comma;
+      tail=&comma->right;
+    }
+    else {
+      *tail=character;
+    }
+  }
+  return list;
+}
+
+bool isCharacter(astnode *term){
+  return term->type!=BINARYOP && term->type!=BRACKET && term->type!=CURLY
+    && term->identifier[0] && !term->identifier[1];
+}
+
+// The text of a string, or NULL if term is not a list of characters.
+// The caller owns the returned text.
+char *stringText(astnode *term, long *length){
+  if(term->type!=BRACKET) return NULL;
+  long n=0;
+  astnode *t=term->right;
+  for(;t && t->type==BINARYOP && !strcmp(t->identifier, ",");t=t->right){
+    if(!isCharacter(t->left)) return NULL;
+    n++;
+  }
+  if(t && !isCharacter(t)) return NULL;
+  char *text=malloc(n+2);
+  n=0;
+  for(t=term->right;t && t->type==BINARYOP;t=t->right){
+    text[n++]=t->left->identifier[0];
+  }
+  if(t) text[n++]=t->identifier[0];
+  text[n]=0;
+  *length=n;
+  return text;
+}
+
+bool isPrimitive(astnode *term){
+  if(term->type!=BINARYOP || strcmp(term->identifier, "@")) return false;
+  if(!term->left || term->left->type!=CONSTANT || !term->right) return false;
+  for(int k=0;primitiveNames[k];k++){
+    if(!strcmp(term->left->identifier, primitiveNames[k])) return true;
+  }
+  return false;
+}
+
+// true while term still holds variables, primitive calls not yet made
+// or anything one of the reduction's rules could rewrite
+bool pendingTerm(brianreduction *r, astnode *term){
+  if(!term) return false;
+  if(term->type==VARIABLE || isPrimitive(term)) return true;
+  for(statementnode *rule=r->lastrule ? r->engine->rules : NULL;rule!=NULL;rule=rule->next){
+    if(equivalent(term, rule->statement->left)) return true;
+    if(rule==r->lastrule) break;
+  }
+  return pendingTerm(r, term->left) || pendingTerm(r, term->right);
+}
+
+astnode *primitiveError(brianengine *e, const char *name, astnode *arg){
+  char *f=formulaText(arg, false);
+  appendMessage(&e->errors, "%s@%s: failed", name, f);
+  freeMemory(BRIAN_MEMORY_FORMULAS, f);
+  return createAST("error", CONSTANT, 0);
+}
+
+astnode *openPrimitive(brianengine *e, const char *name, astnode *arg){
+  long length;
+  char *pathname=stringText(arg, &length);
+  if(!pathname && arg->type==CONSTANT) pathname=strdup(arg->identifier);
+  if(!pathname) return primitiveError(e, name, arg);
+  const char *mode=name[0]=='o' ? "r" : name[0]=='c' ? "w" : "a";
+  int k=openStream(e, pathname, mode);
+  free(pathname);
+  if(k<0) return primitiveError(e, name, arg);
+  char number[16];
+  snprintf(number, sizeof(number), "%d", k);
+  return createAST(number, NUMBER, 0);
+}
+
+astnode *readPrimitive(brianengine *e, const char *name, astnode *arg){
+  astnode *handle=arg;
+  long count=READ_CHUNK;
+  if(arg->type==BINARYOP && !strcmp(arg->identifier, ",")){
+    handle=arg->left;
+    count=arg->right->type==NUMBER ? atol(arg->right->identifier) : 0;
+  }
+  brianstream *s=findStream(e, handle);
+  if(!s || s->writing || count<=0) return primitiveError(e, name, arg);
+  char *text=NULL;
+  long length;
+  if(!strcmp(name, "readline")){
+    size_t size=0;
+    length=getline(&text, &size, s->file);
+    if(length>0 && text[length-1]=='\n') length--;
+  }
+  else {
+    text=malloc(count);
+    if(!text) return primitiveError(e, name, arg);
+    length=fread(text, 1, count, s->file);
+    if(length==0) length=-1;
+  }
+  // eof only at the end of the stream, not when it cannot be read
+  if(length<0 && ferror(s->file)){
+    free(text);
+    return primitiveError(e, name, arg);
+  }
+  astnode *result=length<0 ? createAST("eof", CONSTANT, 0) : createString(text, length);
+  free(text);
+  return result;
+}
+
+astnode *writePrimitive(brianengine *e, const char *name, astnode *arg){
+  if(arg->type!=BINARYOP || strcmp(arg->identifier, ",")) return primitiveError(e, name, arg);
+  brianstream *s=findStream(e, arg->left);
+  if(!s || !s->writing) return primitiveError(e, name, arg);
+  long length;
+  char *text=stringText(arg->right, &length);
+  if(!text){
+    text=getFormula(arg->right, false);
+    length=strlen(text);
+  }
+  fwrite(text, 1, length, s->file);
+  free(text);
+  return copydeepASTNode(arg->left);
+}
+
+astnode *applyPrimitive(brianengine *e, const char *name, astnode *arg){
+  if(!strcmp(name, "read") || !strcmp(name, "readline")) return readPrimitive(e, name, arg);
+  if(!strcmp(name, "write")) return writePrimitive(e, name, arg);
+  if(!strcmp(name, "close")){
+    brianstream *s=findStream(e, arg);
+    if(!s) return primitiveError(e, name, arg);
+    closeStream(s);
+    return createAST("closed", CONSTANT, 0);
+  }
+  return openPrimitive(e, name, arg);
+}
+
+// Makes every ready primitive call in the term at slot, innermost first
+// and left to right, so that side effects happen in reading order.
+bool applyPrimitives(brianreduction *r, astnode **slot){
+  astnode *term=*slot;
+  if(!term) return false;
+  bool applied=applyPrimitives(r, &term->left);
+  applied=applyPrimitives(r, &term->right) || applied;
+  if(!isPrimitive(term) || pendingTerm(r, term->right)) return applied;
+  r->engine->samplephase=SAMPLE_IO;
+  astnode *result=applyPrimitive(r->engine, term->left->identifier, term->right);
+  if(r->engine->trace){
+    traceFormula("  Primitive - ", term);
+    traceFormula("      Transformed Node - ", result);
+  }
+  r->nodes+=countNodes(result)-countNodes(term);
+  r->steps++;
+  r->io=true;
+  freeAST(term);
+  *slot=result;
+  return true;
+}
+
+/*********************************************************
+ * Compact Term Store
+**********************************************************/
+
+#define STORE_INITIAL_NODES 1024
+#define STORE_INITIAL_BUCKETS 256
+// BRIAN_NIL itself is never a node
+#define STORE_MAX_NODES BRIAN_NIL
+
+briantermstore *brianCreateStore(){
+  briantermstore *s=calloc(1, sizeof(briantermstore));
+  s->bucketcount=STORE_INITIAL_BUCKETS;
+  s->buckets=calloc(s->bucketcount, sizeof(unsigned int));
+  return s;
+}
+
+void brianDestroyStore(briantermstore *s){
+  if(!s) return;
+  for(unsigned int k=0;k<s->namecount;k++) free(s->names[k]);
+  free(s->names);
+  free(s->buckets);
+  free(s->symbol);
+  free(s->type);
+  free(s->left);
+  free(s->right);
+  free(s->rulehead);
+  free(s->rulebody);
+  free(s->rulesymbol);
+  free(s->bindsymbol);
+  free(s->bindterm);
+  free(s->stack);
+  free(s);
+}
+
+unsigned int hashName(const char *name, long length){
+  unsigned int h=2166136261u;
+  for(long k=0;k<length;k++) h=(h^(unsigned char)name[k])*16777619u;
+  return h;
+}
+
+void growBuckets(briantermstore *s){
+  free(s->buckets);
+  s->bucketcount*=2;
+  s->buckets=calloc(s->bucketcount, sizeof(unsigned int));
+  for(unsigned int id=0;id<s->namecount;id++){
+    unsigned int b=hashName(s->names[id], strlen(s->names[id])) & (s->bucketcount-1);
+    while(s->buckets[b]) b=(b+1) & (s->bucketcount-1);
+    s->buckets[b]=id+1;
+  }
+}
+
+// Returns the symbol id of name, adding it to the table if it is new.
+unsigned int internSymbol(briantermstore *s, const char *name, long length){
+  unsigned int b=hashName(name, length) & (s->bucketcount-1);
+  while(s->buckets[b]){
+    char *known=s->names[s->buckets[b]-1];
+    if(!strncmp(known, name, length) && known[length]==0) return s->buckets[b]-1;
+    b=(b+1) & (s->bucketcount-1);
+  }
+  if(s->namecount==s->namecapacity){
+    s->namecapacity=s->namecapacity ? s->namecapacity*2 : 64;
+    s->names=realloc(s->names, s->namecapacity*sizeof(char *));
+  }
+  char *copy=malloc(length+1);
+  memcpy(copy, name, length);
+  copy[length]=0;
+  s->names[s->namecount]=copy;
+  s->buckets[b]=++s->namecount;
+  if(s->namecount*2>s->bucketcount) growBuckets(s);
+  return s->namecount-1;
+}
+
+void resizeStore(briantermstore *s, unsigned int capacity){
+  s->capacity=capacity;
+  s->symbol=realloc(s->symbol, (size_t)capacity*sizeof(unsigned int));
+  s->type=realloc(s->type, capacity);
+  s->left=realloc(s->left, (size_t)capacity*sizeof(termindex));
+  s->right=realloc(s->right, (size_t)capacity*sizeof(termindex));
+}
+
+// Adds a node, or returns BRIAN_NIL and marks the store full once every
+// index below BRIAN_NIL is taken.
+termindex addStoreNode(briantermstore *s, unsigned int symbol, termtype type, termindex left, termindex right){
+  if(s->count==s->capacity){
+    if(s->capacity==STORE_MAX_NODES){
+      s->full=true;
+      return BRIAN_NIL;
+    }
+    size_t capacity=s->capacity ? (size_t)s->capacity*2 : STORE_INITIAL_NODES;
+    resizeStore(s, capacity<STORE_MAX_NODES ? capacity : STORE_MAX_NODES);
+  }
+  s->symbol[s->count]=symbol;
+  s->type[s->count]=type;
+  s->left[s->count]=left;
+  s->right[s->count]=right;
+  return s->count++;
+}
+
+void pushStore(briantermstore *s, termindex n){
+  if(s->stacksize==s->stackcapacity){
+    s->stackcapacity=s->stackcapacity ? s->stackcapacity*2 : 256;
+    s->stack=realloc(s->stack, s->stackcapacity*sizeof(termindex));
+  }
+  s->stack[s->stacksize++]=n;
+}
+
+termindex brianStoreTerm(briantermstore *s, astnode *term){
+  if(!term) return BRIAN_NIL;
+  termindex left=brianStoreTerm(s, term->left);
+  termindex right=brianStoreTerm(s, term->right);
+  unsigned int symbol=internSymbol(s, term->identifier, strlen(term->identifier));
+  return addStoreNode(s, symbol, term->type, left, right);
+}
+
+astnode *brianLoadTerm(briantermstore *s, termindex n){
+  if(n==BRIAN_NIL) return NULL;
+  astnode *a=createAST(s->names[s->symbol[n]], s->type[n], n);
+  a->left=brianLoadTerm(s, s->left[n]);
+  a->right=brianLoadTerm(s, s->right[n]);
+  return a;
+}
+
+unsigned int brianStoreNodes(briantermstore *s){
+  return s->count;
+}
+
+size_t brianStoreBytes(briantermstore *s){
+  size_t bytes=(size_t)s->capacity*(sizeof(unsigned int)+1+2*sizeof(termindex));
+  bytes+=s->bucketcount*sizeof(unsigned int)+s->namecapacity*sizeof(char *);
+  for(unsigned int k=0;k<s->namecount;k++) bytes+=strlen(s->names[k])+1;
+  return bytes;
+}
+
+typedef struct FORMULABUFFER{
+  char *text;
+  size_t length;
+  size_t capacity;
+  char *closers;
+  size_t closecount;
+  size_t closecapacity;
+} formulabuffer;
+
+void putFormula(formulabuffer *b, const char *text){
+  size_t n=strlen(text);
+  if(b->length+n+1>b->capacity){
+    while(b->length+n+1>b->capacity) b->capacity=b->capacity ? b->capacity*2 : 256;
+    b->text=realloc(b->text, b->capacity);
+  }
+  memcpy(b->text+b->length, text, n+1);
+  b->length+=n;
+}
+
+void pushCloser(formulabuffer *b, char c){
+  if(b->closecount==b->closecapacity){
+    b->closecapacity=b->closecapacity ? b->closecapacity*2 : 64;
+    b->closers=realloc(b->closers, b->closecapacity);
+  }
+  b->closers[b->closecount++]=c;
+}
+
+// Same text as getFormula, built in one buffer.  Right children, which
+// carry list spines, are followed in a loop rather than by recursion.
+void writeFormula(briantermstore *s, formulabuffer *b, termindex n, bool paren){
+  size_t closefrom=b->closecount;
+  while(n!=BRIAN_NIL){
+    const char *id=s->names[s->symbol[n]];
+    termtype type=s->type[n];
+    if(type==BINARYOP || type==IMPLY){
+      bool application=id[0]=='@' && id[1]==0;
+      bool parens=paren && id[0]!=',';
+      if(parens) putFormula(b, "(");
+      writeFormula(s, b, s->left[n], true);
+      putFormula(b, id);
+      if(application) putFormula(b, "(");
+      if(parens) pushCloser(b, ')');
+      if(application) pushCloser(b, ')');
+      n=s->right[n];
+      paren=true;
+    }
+    else if(type==BRACKET || type==CURLY){
+      putFormula(b, type==BRACKET ? "[" : "{");
+      pushCloser(b, type==BRACKET ? ']' : '}');
+      n=s->right[n];
+      paren=false;
+    }
+    else {
+      putFormula(b, id);
+      break;
+    }
+  }
+  while(b->closecount>closefrom){
+    char closer[2]={b->closers[--b->closecount], 0};
+    putFormula(b, closer);
+  }
+}
+
+char *brianStoreFormula(briantermstore *s, termindex n){
+  formulabuffer b;
+  memset(&b, 0, sizeof(b));
+  putFormula(&b, "");
+  writeFormula(s, &b, n, false);
+  free(b.closers);
+  return b.text;
+}
+
+bool sameStoreTerm(briantermstore *s, termindex a, termindex b){
+  while(true){
+    if(a==b) return true;
+    if(a==BRIAN_NIL || b==BRIAN_NIL) return false;
+    if(s->symbol[a]!=s->symbol[b] || s->type[a]!=s->type[b]) return false;
+    if(!sameStoreTerm(s, s->left[a], s->left[b])) return false;
+    a=s->right[a];
+    b=s->right[b];
+  }
+}
+
+termindex findBinding(briantermstore *s, unsigned int symbol){
+  for(int k=0;k<s->bindcount;k++){
+    if(s->bindsymbol[k]==symbol) return s->bindterm[k];
+  }
+  return BRIAN_NIL;
+}
+
+// the first binding of a variable wins, as in the astnode reducer
+void addBinding(briantermstore *s, unsigned int symbol, termindex term){
+  if(findBinding(s, symbol)!=BRIAN_NIL) return;
+  if(s->bindcount==s->bindcapacity){
+    s->bindcapacity=s->bindcapacity ? s->bindcapacity*2 : 16;
+    s->bindsymbol=realloc(s->bindsymbol, s->bindcapacity*sizeof(unsigned int));
+    s->bindterm=realloc(s->bindterm, s->bindcapacity*sizeof(termindex));
+  }
+  s->bindsymbol[s->bindcount]=symbol;
+  s->bindterm[s->bindcount++]=term;
+}
+
+bool matchStoreNode(briantermstore *s, termindex term, termindex pattern){
+  while(true){
+    if(s->type[pattern]==VARIABLE){
+      addBinding(s, s->symbol[pattern], term);
+      return true;
+    }
+    if(s->symbol[term]!=s->symbol[pattern] || s->type[term]!=s->type[pattern]) return false;
+    if((s->left[term]==BRIAN_NIL)!=(s->left[pattern]==BRIAN_NIL)) return false;
+    if((s->right[term]==BRIAN_NIL)!=(s->right[pattern]==BRIAN_NIL)) return false;
+    if(s->left[term]!=BRIAN_NIL && !matchStoreNode(s, s->left[term], s->left[pattern])) return false;
+    if(s->right[term]==BRIAN_NIL) return true;
+    term=s->right[term];
+    pattern=s->right[pattern];
+  }
+}
+
+// Matches term against pattern as equivalent() and unify() do, leaving
+// the bindings of the pattern's variables in the store's scratch space.
+bool brianStoreMatch(briantermstore *s, termindex term, termindex pattern){
+  s->bindcount=0;
+  return matchStoreNode(s, term, pattern);
+}
+
+// Builds a fresh copy of a rule body; bound variables share the matched
+// subterms instead of copying them.
+termindex instantiateStore(briantermstore *s, termindex body){
+  if(body==BRIAN_NIL) return BRIAN_NIL;
+  if(s->type[body]==VARIABLE){
+    termindex bound=findBinding(s, s->symbol[body]);
+    if(bound!=BRIAN_NIL) return bound;
+  }
+  termindex left=instantiateStore(s, s->left[body]);
+  termindex right=instantiateStore(s, s->right[body]);
+  return addStoreNode(s, s->symbol[body], s->type[body], left, right);
+}
+
+#define ANY_SYMBOL 0xffffffffu
+
+unsigned int storeHeadSymbol(briantermstore *s, termindex n){
+  const char *id=s->names[s->symbol[n]];
+  termindex left=s->left[n];
+  if(s->type[n]==BINARYOP && id[0]=='@' && id[1]==0
+  && left!=BRIAN_NIL && s->type[left]==CONSTANT){
+    return s->symbol[left];
+  }
+  return s->symbol[n];
+}
+
+// copies any engine rules not yet in the store
+void syncStoreRules(brianengine *e, briantermstore *s){
+  statementnode *r=s->lastrule ? s->lastrule->next : e->rules;
+  for(;r!=NULL;r=r->next){
+    s->rulehead=realloc(s->rulehead, (s->rulecount+1)*sizeof(termindex));
+    s->rulebody=realloc(s->rulebody, (s->rulecount+1)*sizeof(termindex));
+    s->rulesymbol=realloc(s->rulesymbol, (s->rulecount+1)*sizeof(unsigned int));
+    termindex head=brianStoreTerm(s, r->statement->left);
+    s->rulehead[s->rulecount]=head;
+    s->rulebody[s->rulecount]=brianStoreTerm(s, r->statement->right);
+    // a head such as X or X@Y can match terms of any head symbol
+    termindex function=s->left[head];
+    bool anysymbol=s->type[head]==VARIABLE || (s->type[head]==BINARYOP
+      && !strcmp(s->names[s->symbol[head]], "@") && function!=BRIAN_NIL && s->type[function]==VARIABLE);
+    s->rulesymbol[s->rulecount]=anysymbol ? ANY_SYMBOL : storeHeadSymbol(s, head);
+    s->rulecount++;
+    s->lastrule=r;
+  }
+}
+
+// Rewrites every outermost match of rule k in the term at n, without
+// looking inside the replacements, which is what one rule of a pass in
+// the astnode reducer does.  Nodes off the rewritten paths are shared,
+// so an unchanged term comes back as the same index.  The right spine
+// is walked in a loop, keeping its nodes on the store's stack.
+termindex rewriteStoreRule(briantermstore *s, termindex n, int k){
+  long base=s->stacksize;
+  termindex result=BRIAN_NIL;
+  while(n!=BRIAN_NIL){
+    if((s->rulesymbol[k]==ANY_SYMBOL || s->rulesymbol[k]==storeHeadSymbol(s, n))
+    && brianStoreMatch(s, n, s->rulehead[k])){
+      result=instantiateStore(s, s->rulebody[k]);
+      break;
+    }
+    termindex left=s->left[n]==BRIAN_NIL ? BRIAN_NIL : rewriteStoreRule(s, s->left[n], k);
+    pushStore(s, n);
+    pushStore(s, left);
+    n=s->right[n];
+  }
+  while(s->stacksize>base){
+    termindex left=s->stack[--s->stacksize];
+    termindex node=s->stack[--s->stacksize];
+    if(left!=s->left[node] || result!=s->right[node]){
+      result=addStoreNode(s, s->symbol[node], s->type[node], left, result);
+    }
+    else {
+      result=node;
+    }
+  }
+  return result;
+}
+
+#define STORE_MARKED 0
+
+// marks the nodes reachable from n, which are BRIAN_NIL until marked
+void markStoreNode(briantermstore *s, termindex *forward, termindex n){
+  long base=s->stacksize;
+  if(n!=BRIAN_NIL) pushStore(s, n);
+  while(s->stacksize>base){
+    n=s->stack[--s->stacksize];
+    if(forward[n]==STORE_MARKED) continue;
+    forward[n]=STORE_MARKED;
+    if(s->left[n]!=BRIAN_NIL) pushStore(s, s->left[n]);
+    if(s->right[n]!=BRIAN_NIL) pushStore(s, s->right[n]);
+  }
+}
+
+// Slides the nodes reachable from the rules and from term down over the
+// garbage that passes leave behind, keeping their order.  Children are
+// always added before their parents, so one sweep upward renumbers every
+// child before the nodes that refer to it.  Returns the new index of
+// term; any other index into the store is no longer valid.
+termindex compactStore(briantermstore *s, termindex term){
+  termindex *forward=malloc((size_t)s->count*sizeof(termindex));
+  memset(forward, 0xff, (size_t)s->count*sizeof(termindex));
+  for(int k=0;k<s->rulecount;k++){
+    markStoreNode(s, forward, s->rulehead[k]);
+    markStoreNode(s, forward, s->rulebody[k]);
+  }
+  markStoreNode(s, forward, term);
+  unsigned int next=0;
+  for(unsigned int n=0;n<s->count;n++){
+    if(forward[n]!=STORE_MARKED) continue;
+    forward[n]=next;
+    s->symbol[next]=s->symbol[n];
+    s->type[next]=s->type[n];
+    s->left[next]=s->left[n]==BRIAN_NIL ? BRIAN_NIL : forward[s->left[n]];
+    s->right[next]=s->right[n]==BRIAN_NIL ? BRIAN_NIL : forward[s->right[n]];
+    next++;
+  }
+  for(int k=0;k<s->rulecount;k++){
+    s->rulehead[k]=forward[s->rulehead[k]];
+    if(s->rulebody[k]!=BRIAN_NIL) s->rulebody[k]=forward[s->rulebody[k]];
+  }
+  if(term!=BRIAN_NIL) term=forward[term];
+  free(forward);
+  s->count=next;
+  s->livecount=next;
+  s->full=false;
+  if(s->capacity>STORE_INITIAL_NODES && next<s->capacity/4){
+    resizeStore(s, next*2>STORE_INITIAL_NODES ? next*2 : STORE_INITIAL_NODES);
+  }
+  return term;
+}
+
+// Passes over the rules until one changes nothing.  The store is
+// compacted whenever it has doubled since the last compaction, so its
+// size follows the live term rather than the length of the reduction.
+termindex brianStoreReduce(brianengine *e, briantermstore *s, termindex term){
+  syncStoreRules(e, s);
+  bool changed=true;
+  while(changed){
+    termindex passstart=term;
+    for(int k=0;k<s->rulecount;k++){
+      term=rewriteStoreRule(s, term, k);
+    }
+    if(s->full) return BRIAN_NIL;
+    changed=!sameStoreTerm(s, passstart, term);
+    if(s->count>STORE_INITIAL_NODES && s->count/2>=s->livecount) term=compactStore(s, term);
+  }
+  return term;
+}
+
+/*********************************************************
+ * Incremental Evaluation
+**********************************************************/
+
+// A statement's reduction can only have used rules whose head symbol is
+// the head of some term that appeared during it, or whose head is a
+// variable.  So long as those rules, in order, are the same as before,
+// reducing it again gives the same result, and the cached one is used.
+
+termcache *createCache(){
+  termcache *c=calloc(1, sizeof(termcache));
+  c->bucketcount=64;
+  c->buckets=calloc(c->bucketcount, sizeof(cacheentry *));
+  return c;
+}
+
+void freeCacheEntry(cacheentry *entry){
+  free(entry->key);
+  freeStatementTerms(entry->terms);
+  free(entry->errors);
+  for(int k=0;k<entry->symbolcount;k++) free(entry->symbols[k]);
+  free(entry->symbols);
+  free(entry->signature);
+  free(entry);
+}
+
+void freeCache(termcache *c){
+  if(!c) return;
+  for(unsigned int b=0;b<c->bucketcount;b++){
+    cacheentry *entry=c->buckets[b];
+    while(entry){
+      cacheentry *next=entry->next;
+      freeCacheEntry(entry);
+      entry=next;
+    }
+  }
+  free(c->buckets);
+  free(c);
+}
+
+cacheentry *findCache(termcache *c, const char *key, long length){
+  if(!c) return NULL;
+  cacheentry *entry=c->buckets[hashName(key, length) & (c->bucketcount-1)];
+  while(entry && (strncmp(entry->key, key, length) || entry->key[length])) entry=entry->next;
+  return entry;
+}
+
+// Adds an empty entry for key, which must not be in the table yet.
+cacheentry *insertCache(termcache *c, const char *key, long length){
+  if(c->count>=c->bucketcount){
+    unsigned int bucketcount=c->bucketcount*2;
+    cacheentry **buckets=calloc(bucketcount, sizeof(cacheentry *));
+    for(unsigned int b=0;b<c->bucketcount;b++){
+      while(c->buckets[b]){
+        cacheentry *entry=c->buckets[b];
+        c->buckets[b]=entry->next;
+        unsigned int nb=hashName(entry->key, strlen(entry->key)) & (bucketcount-1);
+        entry->next=buckets[nb];
+        buckets[nb]=entry;
+      }
+    }
+    free(c->buckets);
+    c->buckets=buckets;
+    c->bucketcount=bucketcount;
+  }
+  cacheentry *entry=calloc(1, sizeof(cacheentry));
+  entry->key=malloc(length+1);
+  memcpy(entry->key, key, length);
+  entry->key[length]=0;
+  unsigned int b=hashName(key, length) & (c->bucketcount-1);
+  entry->next=c->buckets[b];
+  c->buckets[b]=entry;
+  c->count++;
+  return entry;
+}
+
+bool hasSymbol(char **symbols, int count, const char *symbol){
+  for(int k=0;k<count;k++){
+    if(!strcmp(symbols[k], symbol)) return true;
+  }
+  return false;
+}
+
+void noteSymbols(brianreduction *r, astnode *term){
+  if(!term) return;
+  const char *symbol=headSymbol(term);
+  if(!hasSymbol(r->symbols, r->symbolcount, symbol)){
+    if(r->symbolcount==r->symbolcapacity){
+      r->symbolcapacity=r->symbolcapacity ? r->symbolcapacity*2 : 16;
+      r->symbols=realloc(r->symbols, sizeof(char *)*r->symbolcapacity);
+    }
+    r->symbols[r->symbolcount++]=strdup(symbol);
+  }
+  noteSymbols(r, term->left);
+  noteSymbols(r, term->right);
+}
+
+// The rules up to lastrule that could match a term with one of symbols
+// at its head, in order.
+char *ruleSignature(brianengine *e, statementnode *lastrule, char **symbols, int count){
+  char *signature=NULL;
+  for(statementnode *rule=lastrule ? e->rules : NULL;rule!=NULL;rule=rule->next){
+    astnode *head=rule->statement->left;
+    if(matchesAnySymbol(head) || hasSymbol(symbols, count, headSymbol(head))){
+      char *f=formulaText(rule->statement, false);
+      appendText(&signature, f);
+      appendText(&signature, "\n");
+      freeMemory(BRIAN_MEMORY_FORMULAS, f);
+    }
+    if(rule==lastrule) break;
+  }
+  return signature ? signature : strdup("");
+}
+
+void storeResult(brianengine *e, brianreduction *r){
+  long length=strlen(r->cachekey);
+  cacheentry *entry=findCache(e->results, r->cachekey, length);
+  if(!entry){
+    entry=insertCache(e->results, r->cachekey, length);
+  }
+  else {
+    freeStatementTerms(entry->terms);
+    for(int k=0;k<entry->symbolcount;k++) free(entry->symbols[k]);
+    free(entry->symbols);
+    free(entry->signature);
+  }
+  entry->terms=createStatement(copydeepASTNode(r->term));
+  entry->signature=ruleSignature(e, r->lastrule, r->symbols, r->symbolcount);
+  entry->symbols=r->symbols;
+  entry->symbolcount=r->symbolcount;
+  r->symbols=NULL;
+  r->symbolcount=0;
+}
+
+// A copy of the cached result of prog if the rules it may depend on are
+// unchanged, or NULL.
+astnode *cachedResult(brianengine *e, astnode *prog){
+  char *key=formulaText(prog, false);
+  cacheentry *entry=findCache(e->results, key, strlen(key));
+  freeMemory(BRIAN_MEMORY_FORMULAS, key);
+  if(!entry) return NULL;
+  statementnode *lastrule=e->rules;
+  while(lastrule && lastrule->next) lastrule=lastrule->next;
+  char *signature=ruleSignature(e, lastrule, entry->symbols, entry->symbolcount);
+  bool same=!strcmp(signature, entry->signature);
+  free(signature);
+  return same ? copydeepASTNode(entry->terms->statement) : NULL;
+}
+
+// Drops the cached results of statements no longer in the program, so
+// the cache holds at most one entry for each statement of the last load.
+void pruneResults(brianengine *e){
+  if(!e->results) return;
+  termcache *current=createCache();
+  for(statementnode *s=e->program;s!=NULL;s=s->next){
+    if(!s->statement) continue;
+    char *key=formulaText(s->statement, false);
+    long length=strlen(key);
+    if(!findCache(current, key, length)) insertCache(current, key, length);
+    freeMemory(BRIAN_MEMORY_FORMULAS, key);
+  }
+  for(unsigned int b=0;b<e->results->bucketcount;b++){
+    cacheentry **link=&e->results->buckets[b];
+    while(*link){
+      cacheentry *entry=*link;
+      if(findCache(current, entry->key, strlen(entry->key))){
+        link=&entry->next;
+        continue;
+      }
+      *link=entry->next;
+      freeCacheEntry(entry);
+      e->results->count--;
+    }
+  }
+  freeCache(current);
+}
+
+// Frees the suspended reductions of the last run and the rules it added,
+// leaving rules loaded with brianLoadRules.  A suspended statement keeps
+// its partially reduced term.
+void dropRun(brianengine *e){
+  while(e->suspended){
+    brianreduction *r=e->suspended;
+    e->suspended=r->next;
+    freeReduction(r);
+  }
+  if(e->runrules){
+    if(e->rules==e->runrules){
+      e->rules=NULL;
+    }
+    else {
+      statementnode *rule=e->rules;
+      while(rule->next!=e->runrules) rule=rule->next;
+      rule->next=NULL;
+    }
+    freeStatementTerms(e->runrules);
+    e->runrules=NULL;
+  }
+}
+
+void dropProgram(brianengine *e){
+  dropRun(e);
+  freeStatementTerms(e->program);
+  e->program=NULL;
+}
+
+/*********************************************************
+ * Profile Guided Rule Ordering
+**********************************************************/
+
+// A profile counts the rewrites made by each rule, by formula, and the
+// terms seen at the start of each pass, by head symbol.  It is written
+// one count a line, most frequent first:
+//   rule 1042 (car@([A,B]))->A
+//   symbol 3310 car
+// with newlines and backslashes in names escaped.
+
+void addCount(termcache **table, const char *key, long count){
+  if(!*table) *table=createCache();
+  long length=strlen(key);
+  cacheentry *entry=findCache(*table, key, length);
+  if(!entry) entry=insertCache(*table, key, length);
+  entry->count+=count;
+}
+
+long findCount(termcache *table, const char *key){
+  cacheentry *entry=findCache(table, key, strlen(key));
+  return entry ? entry->count : 0;
+}
+
+void countRuleHits(brianengine *e, astnode *rule, long hits){
+  char *f=formulaText(rule, false);
+  addCount(&e->rulehits, f, hits);
+  freeMemory(BRIAN_MEMORY_FORMULAS, f);
+}
+
+void countSymbols(brianengine *e, astnode *term){
+  if(!term) return;
+  addCount(&e->symbolhits, headSymbol(term), 1);
+  countSymbols(e, term->left);
+  countSymbols(e, term->right);
+}
+
+int compareCounts(const void *a, const void *b){
+  long ca=(*(cacheentry **)a)->count;
+  long cb=(*(cacheentry **)b)->count;
+  if(ca!=cb) return ca<cb ? 1 : -1;
+  return strcmp((*(cacheentry **)a)->key, (*(cacheentry **)b)->key);
+}
+
+void writeCounts(FILE *f, const char *kind, termcache *table){
+  if(!table) return;
+  cacheentry **entries=malloc(sizeof(cacheentry *)*(table->count+1));
+  unsigned int n=0;
+  for(unsigned int b=0;b<table->bucketcount;b++){
+    for(cacheentry *entry=table->buckets[b];entry!=NULL;entry=entry->next) entries[n++]=entry;
+  }
+  qsort(entries, n, sizeof(cacheentry *), compareCounts);
+  for(unsigned int k=0;k<n;k++){
+    fprintf(f, "%s %ld ", kind, entries[k]->count);
+    for(const char *c=entries[k]->key;*c;c++){
+      if(*c=='\n') fputs("\\n", f);
+      else if(*c=='\\') fputs("\\\\", f);
+      else fputc(*c, f);
+    }
+    fputc('\n', f);
+  }
+  free(entries);
+}
+
+// Reads the counts of one profile line into the matching table.
+void readCount(brianengine *e, char *line){
+  char kind[8];
+  long count;
+  int used;
+  if(sscanf(line, "%7s %ld %n", kind, &count, &used)<2) return;
+  char *key=line+used;
+  char *out=key;
+  for(char *c=key;*c && *c!='\n';c++){
+    if(*c=='\\' && c[1]){
+      c++;
+      *out++=*c=='n' ? '\n' : *c;
+    }
+    else {
+      *out++=*c;
+    }
+  }
+  *out=0;
+  if(!strcmp(kind, "rule")) addCount(&e->rulehits, key, count);
+  else if(!strcmp(kind, "symbol")) addCount(&e->symbolhits, key, count);
+}
+
+// true if some term could match both patterns
+bool unifiablePatterns(astnode *a, astnode *b){
+  if(a->type==VARIABLE || b->type==VARIABLE) return true;
+  if(a->type!=b->type || strcmp(a->identifier, b->identifier)) return false;
+  if(!a->left!=!b->left || !a->right!=!b->right) return false;
+  return (!a->left || unifiablePatterns(a->left, b->left))
+    && (!a->right || unifiablePatterns(a->right, b->right));
+}
+
+// true if pattern b could match a term that pattern a, or one of its
+// subterms that is not a variable, also matches
+bool patternOverlaps(astnode *a, astnode *b){
+  if(!a || a->type==VARIABLE) return false;
+  if(unifiablePatterns(a, b)) return true;
+  return patternOverlaps(a->left, b) || patternOverlaps(a->right, b);
+}
+
+// Rules depend on each other when they could match the same term, or
+// when one could build a term the other matches, even in part.
+bool rulesDepend(astnode *a, astnode *b){
+  return patternOverlaps(a->left, b->left) || patternOverlaps(b->left, a->left)
+    || patternOverlaps(a->right, b->left) || patternOverlaps(b->left, a->right)
+    || patternOverlaps(b->right, a->left) || patternOverlaps(a->left, b->right);
+}
+
+// Reorders the count rules in run, hottest first (more hits, then a more
+// frequent head symbol), except that a rule is never moved ahead of an
+// earlier rule it depends on.  Independent rules neither compete for a
+// rewrite nor make work for each other, so their order does not change
+// the result of a reduction.
+void orderRuleRun(brianengine *e, statementnode *run, int count){
+  astnode **rules=malloc(sizeof(astnode *)*count);
+  long *hits=malloc(sizeof(long)*count);
+  long *symbols=malloc(sizeof(long)*count);
+  bool *placed=calloc(count, sizeof(bool));
+  bool *depends=malloc(sizeof(bool)*count*count);
+  statementnode *s=run;
+  for(int k=0;k<count;k++,s=s->next){
+    rules[k]=s->statement;
+    char *f=formulaText(rules[k], false);
+    hits[k]=findCount(e->rulehits, f);
+    freeMemory(BRIAN_MEMORY_FORMULAS, f);
+    symbols[k]=findCount(e->symbolhits, headSymbol(rules[k]->left));
+  }
+  for(int i=0;i<count;i++){
+    for(int j=0;j<i;j++) depends[i*count+j]=rulesDepend(rules[i], rules[j]);
+  }
+  s=run;
+  for(int n=0;n<count;n++,s=s->next){
+    int best=-1;
+    for(int i=0;i<count;i++){
+      if(placed[i]) continue;
+      bool ready=true;
+      for(int j=0;j<i && ready;j++) ready=placed[j] || !depends[i*count+j];
+      if(!ready) continue;
+      if(best<0 || hits[i]>hits[best] || (hits[i]==hits[best] && symbols[i]>symbols[best])) best=i;
+    }
+    placed[best]=true;
+    s->statement=rules[best];
+  }
+  free(depends);
+  free(placed);
+  free(symbols);
+  free(hits);
+  free(rules);
+}
+
+bool isRuleStatement(statementnode *s){
+  return s->statement && !strcmp(s->statement->identifier, "->");
+}
+
+// Orders every run of consecutive rules in list; a rule never crosses a
+// statement, so every statement is still reduced with the same rules.
+void orderRuleList(brianengine *e, statementnode *list){
+  while(list!=NULL){
+    if(!isRuleStatement(list)){
+      list=list->next;
+      continue;
+    }
+    statementnode *run=list;
+    int count=0;
+    while(list!=NULL && isRuleStatement(list)){
+      count++;
+      list=list->next;
+    }
+    if(count>1) orderRuleRun(e, run, count);
+  }
+}
+
+void brianSetProfiling(brianengine *e, bool profiling){
+  e->profiling=profiling;
+}
+
+bool brianWriteProfile(brianengine *e, const char *pathname){
+  FILE *f=fopen(pathname, "w");
+  if(f==NULL) return false;
+  writeCounts(f, "rule", e->rulehits);
+  writeCounts(f, "symbol", e->symbolhits);
+  fclose(f);
+  return true;
+}
+
+int brianOrderRules(brianengine *e, const char *pathname){
+  FILE *f=fopen(pathname, "r");
+  if(f==NULL){
+    appendMessage(&e->errors, "Cannot read %s", pathname);
+    return -1;
+  }
+  freeCache(e->rulehits);
+  freeCache(e->symbolhits);
+  e->rulehits=NULL;
+  e->symbolhits=NULL;
+  char *line=NULL;
+  size_t size=0;
+  while(getline(&line, &size, f)>=0) readCount(e, line);
+  free(line);
+  fclose(f);
+  if(e->rulehits || e->symbolhits){
+    orderRuleList(e, e->rules);
+    orderRuleList(e, e->program);
+  }
+  return 0;
+}
+
+/*********************************************************
+ * Partial Evaluation
+**********************************************************/
+
+// A rule body is reduced with the rules visible to the first statement
+// after the rule, so that work the body always leads to is done once
+// instead of on every use.  Matching a term that holds variables is
+// sound: any instance of it matches the same rules.  Only rules whose
+// head overlaps no other rule's head, nor itself below the root, are
+// used.  Such a rewrite commutes with any other, so making it early
+// cannot change a normal form the program reaches.  The body's variables
+// are renamed out of the way of the rules' own first.  A body whose
+// reduction runs past its budget or cycles is left as it was.
+
+void markVariables(astnode *term, bool mark){
+  if(!term) return;
+  if(term->type==VARIABLE){
+    size_t length=strlen(term->identifier);
+    if(mark){
+      releaseMemory(BRIAN_MEMORY_NODES, term->identifier);
+      term->identifier=accountMemory(BRIAN_MEMORY_NODES, realloc(term->identifier, length+2));
+      strcpy(term->identifier+length, "#");
+    }
+    else if(length && term->identifier[length-1]=='#'){
+      term->identifier[length-1]=0;
+    }
+  }
+  markVariables(term->left, mark);
+  markVariables(term->right, mark);
+}
+
+// Reduces the body of rule with the rules of scratch; returns true if it
+// changed.
+bool evaluateBody(brianengine *scratch, astnode *rule){
+  astnode *body=copydeepASTNode(rule->right);
+  markVariables(body, true);
+  brianbudget budget={PARTIAL_EVAL_STEPS, PARTIAL_EVAL_GROWTH*countNodes(body)+64, 0};
+  brianreduction *r=createReduction(scratch, body, NULL);
+  brianstatus status=continueReduction(r, &budget);
+  body=r->term;
+  freeReduction(r);
+  markVariables(body, false);
+  if(status!=BRIAN_DONE || sameTerm(body, rule->right)){
+    freeAST(body);
+    return false;
+  }
+  freeAST(rule->right);
+  rule->right=body;
+  return true;
+}
+
+// true if rule k of rules may be applied ahead of time
+bool isolatedRule(astnode **rules, int count, int k){
+  astnode *head=rules[k]->left;
+  if(patternOverlaps(head->left, head) || patternOverlaps(head->right, head)) return false;
+  for(int j=0;j<count;j++){
+    if(j==k) continue;
+    if(patternOverlaps(head, rules[j]->left) || patternOverlaps(rules[j]->left, head)) return false;
+  }
+  return true;
+}
+
+// Marks the rules that may be applied ahead of time: isolated rules that
+// depend on no unmarked rule.  Applying a rule early only changes when
+// its rewrite happens, which matters if it feeds or consumes a rule whose
+// matches compete with another's, directly or through other rules, so
+// the marked set is narrowed until it is closed.
+void markUsableRules(astnode **rules, int count, bool *usable){
+  for(int k=0;k<count;k++) usable[k]=isolatedRule(rules, count, k);
+  bool narrowed=true;
+  while(narrowed){
+    narrowed=false;
+    for(int k=0;k<count;k++){
+      for(int j=0;usable[k] && j<count;j++){
+        if(!usable[j] && rulesDepend(rules[k], rules[j])){
+          usable[k]=false;
+          narrowed=true;
+        }
+      }
+    }
+  }
+}
+
+// Evaluates the bodies of the rules in list, adding each run of usable
+// rules to scratch before its bodies are reduced; next counts through
+// rules.
+int evaluateRuleList(brianengine *scratch, statementnode *list, bool *usable, int *next){
+  int changed=0;
+  while(list!=NULL){
+    if(!isRuleStatement(list)){
+      list=list->next;
+      continue;
+    }
+    statementnode *run=list;
+    while(list!=NULL && isRuleStatement(list)){
+      if(usable[(*next)++]){
+        appendRule(scratch, createStatement(copydeepASTNode(list->statement)));
+      }
+      list=list->next;
+    }
+    for(statementnode *s=run;s!=list;s=s->next){
+      if(evaluateBody(scratch, s->statement)) changed++;
+    }
+  }
+  return changed;
+}
+
+int brianPartialEvaluate(brianengine *e){
+  int count=0;
+  for(statementnode *s=e->rules;s!=NULL;s=s->next) count++;
+  for(statementnode *s=e->program;s!=NULL;s=s->next) count+=isRuleStatement(s);
+  astnode **rules=malloc(sizeof(astnode *)*(count+1));
+  count=0;
+  for(statementnode *s=e->rules;s!=NULL;s=s->next) rules[count++]=s->statement;
+  for(statementnode *s=e->program;s!=NULL;s=s->next){
+    if(isRuleStatement(s)) rules[count++]=s->statement;
+  }
+  bool *usable=malloc(sizeof(bool)*(count+1));
+  markUsableRules(rules, count, usable);
+  brianengine *scratch=brianCreate();
+  scratch->loadtime=true;
+  scratch->cyclecheck=BRIAN_CYCLES_BRENT;
+  int next=0;
+  int changed=evaluateRuleList(scratch, e->rules, usable, &next);
+  changed+=evaluateRuleList(scratch, e->program, usable, &next);
+  brianDestroy(scratch);
+  free(usable);
+  free(rules);
+  return changed;
+}
+
+/*********************************************************
+ * Sampling Profiler
+**********************************************************/
+
+// A CPU time timer interrupts the reduction and the handler counts what
+// it was doing: the statement, the rule being matched or applied, the
+// phase of the pass and, for a rewrite, the chain of rule applications
+// that built the node being rewritten.  The handler only reads fields
+// the reducer publishes and counts into a table allocated beforehand.
+// One engine can be sampled at a time.
+
+const char *samplePhaseNames[]={"idle", "match", "rewrite", "compare", "io"};
+
+brianengine *volatile sampledengine=NULL;
+struct sigaction previousprofhandler;
+
+void markChain(astnode *term, int chain){
+  if(!term) return;
+  term->chain=chain;
+  markChain(term->left, chain);
+  markChain(term->right, chain);
+}
+
+unsigned int hashChain(int parent, astnode *rule){
+  unsigned long long h=((unsigned long long)(size_t)rule)*0x9e3779b97f4a7c15ULL;
+  return (unsigned int)((h>>32)^(unsigned int)parent*2654435761u);
+}
+
+// The chain for rule applied to a node built by parent.  When the table
+// is full, new work is put down to the parent chain.
+int findChain(brianengine *e, int parent, astnode *rule){
+  if(parent<0 || parent>=e->chaincount) parent=0;
+  unsigned int b=hashChain(parent, rule) & (2*MAX_REWRITE_CHAINS-1);
+  while(e->chainbuckets[b]){
+    rewritechain *c=&e->chains[e->chainbuckets[b]];
+    if(c->parent==parent && c->rule==rule) return e->chainbuckets[b];
+    b=(b+1) & (2*MAX_REWRITE_CHAINS-1);
+  }
+  if(e->chaincount>=MAX_REWRITE_CHAINS) return parent;
+  int k=e->chaincount;
+  e->chains[k].parent=parent;
+  e->chains[k].rule=rule;
+  e->chainbuckets[b]=k;
+  e->chaincount=k+1;
+  return k;
+}
+
+void takeSample(int signal){
+  brianengine *e=sampledengine;
+  (void)signal;
+  if(!e || e->samplephase==SAMPLE_IDLE) return;
+  int statement=e->samplestatement;
+  int chain=e->samplechain;
+  astnode *rule=e->samplerule;
+  samplephase phase=e->samplephase;
+  if(chain<0 || chain>=e->chaincount) chain=0;
+  unsigned int h=hashChain(chain, rule)^(unsigned int)statement*40503u^(unsigned int)phase;
+  for(int k=0;k<SAMPLE_SLOTS;k++){
+    sampleslot *slot=&e->samples[(h+k) & (SAMPLE_SLOTS-1)];
+    if(!slot->count){
+      slot->statement=statement;
+      slot->chain=chain;
+      slot->rule=rule;
+      slot->phase=phase;
+      slot->count=1;
+      return;
+    }
+    if(slot->statement==statement && slot->chain==chain && slot->rule==rule && slot->phase==phase){
+      slot->count++;
+      return;
+    }
+  }
+  e->sampleslost++;
+}
+
+bool brianStartSampling(brianengine *e, long interval){
+  if(!__sync_bool_compare_and_swap(&sampledengine, NULL, e)) return false;
+  if(!e->chains){
+    e->chains=calloc(MAX_REWRITE_CHAINS, sizeof(rewritechain));
+    e->chainbuckets=calloc(2*MAX_REWRITE_CHAINS, sizeof(int));
+    e->samples=calloc(SAMPLE_SLOTS, sizeof(sampleslot));
+    e->chaincount=1;
+  }
+  e->sampling=true;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler=takeSample;
+  action.sa_flags=SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, &previousprofhandler);
+  struct itimerval timer={{interval/1000000, interval%1000000}, {interval/1000000, interval%1000000}};
+  setitimer(ITIMER_PROF, &timer, NULL);
+  return true;
+}
+
+void brianStopSampling(brianengine *e){
+  if(sampledengine!=e) return;
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  sigaction(SIGPROF, &previousprofhandler, NULL);
+  sampledengine=NULL;
+  e->sampling=false;
+}
+
+// writes a rule as one flame graph frame, which may not hold ';'
+void writeFrame(FILE *f, astnode *rule){
+  char *formula=formulaText(rule, false);
+  fputc(';', f);
+  for(char *c=formula;*c;c++) fputc(*c==';' || *c=='\n' ? '_' : *c, f);
+  freeMemory(BRIAN_MEMORY_FORMULAS, formula);
+}
+
+bool brianWriteSamples(brianengine *e, const char *pathname){
+  FILE *f=fopen(pathname, "w");
+  if(f==NULL) return false;
+  int chain[MAX_SAMPLE_DEPTH];
+  for(int k=0;e->samples && k<SAMPLE_SLOTS;k++){
+    sampleslot *slot=&e->samples[k];
+    if(!slot->count) continue;
+    if(slot->statement>0) fprintf(f, "statement %d", slot->statement);
+    else fprintf(f, "term");
+    int depth=0;
+    int c=slot->chain;
+    while(c>0 && depth<MAX_SAMPLE_DEPTH){
+      chain[depth++]=c;
+      c=e->chains[c].parent;
+    }
+    if(c>0) fprintf(f, ";...");
+    while(depth>0) writeFrame(f, e->chains[chain[--depth]].rule);
+    if(slot->rule) writeFrame(f, slot->rule);
+    fprintf(f, ";%s %ld\n", samplePhaseNames[slot->phase], slot->count);
+  }
+  if(e->sampleslost) fprintf(f, "lost %ld\n", e->sampleslost);
+  fclose(f);
+  return true;
+}
+
+/*********************************************************
+ * Engine
+**********************************************************/
+
+brianengine *brianCreate(){
+  initScanner();
+  pthread_once(&consoleinit, bufferConsole);
+  return calloc(1, sizeof(brianengine));
+}
+
+void brianDestroy(brianengine *e){
+  if(!e) return;
+  while(e->suspended){
+    brianreduction *r=e->suspended;
+    e->suspended=r->next;
+    freeReduction(r);
+  }
+  freeStatementTerms(e->program);
+  freeStatementTerms(e->rules);
+  freeAST(e->result);
+  freeMemory(BRIAN_MEMORY_FORMULAS, e->resulttext);
+  free(e->errors);
+  closeStreams(e);
+  freeCache(e->sources);
+  freeCache(e->results);
+  freeCache(e->rulehits);
+  freeCache(e->symbolhits);
+  brianStopSampling(e);
+  free(e->chains);
+  free(e->chainbuckets);
+  free(e->samples);
+  free(e);
+}
+
+void brianSetTrace(brianengine *e, bool trace){
+  e->trace=trace;
+}
+
+void clearErrors(brianengine *e){
+  free(e->errors);
+  e->errors=NULL;
+}
+
+const char *brianErrors(brianengine *e){
+  return e->errors;
+}
+
+int brianLoad(brianengine *e, const char *text, long length){
+  clearErrors(e);
+  return parseMemFile(e, text, length);
+}
+
+int brianLoadFile(brianengine *e, const char *pathname){
+  long length;
+  char *memfile=loadMemFile(pathname, &length);
+  clearErrors(e);
+  if(!memfile){
+    appendMessage(&e->errors, "Cannot read %s", pathname);
+    return -1;
+  }
+  int errorcount=parseMemFile(e, memfile, length);
+  free(memfile);
+  return errorcount;
+}
+
+int brianReload(brianengine *e, const char *text, long length){
+  clearErrors(e);
+  initScanner();
+  dropProgram(e);
+  termcache *sources=createCache();
+  statementnode *last=NULL;
+  int errorcount=0;
+  long start=0;
+  e->parsedcount=0;
+  while(start<length){
+    long end=nextStatementBoundary(text, start, length, start);
+    cacheentry *entry=findCache(sources, text+start, end-start);
+    if(!entry){
+      entry=insertCache(sources, text+start, end-start);
+      // spans with errors are parsed again so their line numbers are right
+      cacheentry *old=findCache(e->sources, text+start, end-start);
+      if(old && !old->errors){
+        entry->terms=old->terms;
+        old->terms=NULL;
+      }
+      else {
+        parser *p=createParser(text+start, end-start, start);
+        parseText(p);
+        entry->terms=p->program;
+        entry->errors=p->errors;
+        free(p);
+        for(statementnode *s=entry->terms;s!=NULL;s=s->next) e->parsedcount++;
+      }
+    }
+    if(entry->errors){
+      appendText(&e->errors, entry->errors);
+      errorcount++;
+    }
+    for(statementnode *s=entry->terms;s!=NULL;s=s->next){
+      statementnode *copy=createStatement(copydeepASTNode(s->statement));
+      if(last) last->next=copy;
+      else e->program=copy;
+      last=copy;
+    }
+    start=end;
+  }
+  freeCache(e->sources);
+  e->sources=sources;
+  pruneResults(e);
+  return errorcount;
+}
+
+int brianReloadFile(brianengine *e, const char *pathname){
+  long length;
+  char *memfile=loadMemFile(pathname, &length);
+  if(!memfile){
+    clearErrors(e);
+    appendMessage(&e->errors, "Cannot read %s", pathname);
+    return -1;
+  }
+  int errorcount=brianReload(e, memfile, length);
+  free(memfile);
+  return errorcount;
+}
+
+void brianSetIncremental(brianengine *e, bool incremental){
+  e->incremental=incremental;
+  if(incremental && !e->results) e->results=createCache();
+}
+
+int brianParsedCount(brianengine *e){
+  return e->parsedcount;
+}
+
+int brianReducedCount(brianengine *e){
+  return e->reducedcount;
+}
+
+int brianLoadRules(brianengine *e, const char *text, long length){
+  clearErrors(e);
+  parser *p=createParser(text, length, 0);
+  parseText(p);
+  int errorcount=p->errorcount;
+  statementnode *s=p->program;
+  while(s!=NULL){
+    statementnode *next=s->next;
+    s->next=NULL;
+    if(s->statement && !strcmp(s->statement->identifier, "->")){
+      appendRule(e, s);
+    }
+    else {
+      appendMessage(&p->errors, "Not a rule: statement ignored");
+      errorcount++;
+      freeStatementTerms(s);
+    }
+    s=next;
+  }
+  if(p->errors) appendText(&e->errors, p->errors);
+  free(p->errors);
+  free(p);
+  return errorcount;
+}
+
+void brianSetBudget(brianengine *e, brianbudget *budget){
+  if(budget){
+    e->budget=*budget;
+  }
+  else {
+    memset(&e->budget, 0, sizeof(brianbudget));
+  }
+}
+
+void brianSetCycleCheck(brianengine *e, briancyclecheck check, int window){
+  e->cyclecheck=check;
+  e->cyclewindow=window;
+}
+
+void brianSetMemoryLimit(brianengine *e, long perstatement, long perrun){
+  e->statementmemory=perstatement;
+  e->runmemory=perrun;
+}
+
+bool budgetLimited(brianbudget *budget){
+  return budget->maxsteps || budget->maxnodes || budget->maxmillis;
+}
+
+// Gives reduction r one budget's worth of work; an unfinished reduction
+// is queued on the engine's suspended list.
+void runSlice(brianengine *e, brianreduction *r, brianreduction **tail){
+  brianstatus status=continueReduction(r, budgetLimited(&e->budget) ? &e->budget : NULL);
+  e->samplephase=SAMPLE_IDLE;
+  if(status==BRIAN_MEMORY_EXHAUSTED){
+    appendMessage(&e->errors, "Statement %d aborted after %ld steps: memory limit exceeded",
+      r->index, r->steps);
+    abortTerm(r);
+  }
+  r->statement->statement=r->term;
+  if(status==BRIAN_CYCLE){
+    appendMessage(&e->errors, "Statement %d stopped after %ld steps: cycle of %ld passes",
+      r->index, r->steps, r->cyclelength);
+  }
+  if(status==BRIAN_DONE && r->cachekey && !r->io) storeResult(e, r);
+  if(status==BRIAN_DONE || status==BRIAN_CYCLE || status==BRIAN_MEMORY_EXHAUSTED){
+    freeReduction(r);
+    return;
+  }
+  appendMessage(&e->errors, "Statement %d suspended after %ld steps: %s",
+    r->index, r->steps, budgetMessage(status));
+  r->next=NULL;
+  if(*tail) (*tail)->next=r;
+  else e->suspended=r;
+  *tail=r;
+}
+
+int countSuspended(brianengine *e){
+  int n=0;
+  for(brianreduction *r=e->suspended;r!=NULL;r=r->next) n++;
+  return n;
+}
+
+int brianRun(brianengine *e){
+  clearErrors(e);
+  dropRun(e);
+  brianreduction *tail=NULL;
+  statementnode *stmnt=e->program;
+  int index=1;
+  e->reducedcount=0;
+  e->runused=0;
+  e->runstart=memoryusage.total;
+  while(stmnt!=NULL){
+    astnode *prog=stmnt->statement;
+    astnode *cached;
+    if(prog){
+      // put Rules in the Rules list
+      if(!strcmp(prog->identifier,"->")){
+        statementnode *newstmnt=createStatement(copydeepASTNode(prog));
+        appendRule(e, newstmnt);
+        if(!e->runrules) e->runrules=newstmnt;
+      }
+      else if(e->incremental && (cached=cachedResult(e, prog))){
+        stmnt->statement=cached;
+        freeAST(prog);
+      }
+      else{
+        // reduce program line
+        e->reducedcount++;
+        brianreduction *r=createReduction(e, prog, stmnt);
+        r->index=index;
+        runSlice(e, r, &tail);
+      }
+    }
+    stmnt=stmnt->next;
+    index++;
+  }
+  e->runused+=memoryusage.total-e->runstart;
+  return countSuspended(e);
+}
+
+int brianResume(brianengine *e){
+  clearErrors(e);
+  brianreduction *r=e->suspended;
+  brianreduction *tail=NULL;
+  e->suspended=NULL;
+  e->runstart=memoryusage.total;
+  while(r!=NULL){
+    brianreduction *next=r->next;
+    runSlice(e, r, &tail);
+    r=next;
+  }
+  e->runused+=memoryusage.total-e->runstart;
+  return countSuspended(e);
+}
+
+// As brianRun, but each statement is reduced in a compact term store
+// that keeps only the rules between statements.  Budgets and cycle checks
+// do not apply.
+void brianRunCompact(brianengine *e){
+  clearErrors(e);
+  dropRun(e);
+  briantermstore *store=brianCreateStore();
+  int index=0;
+  for(statementnode *stmnt=e->program;stmnt!=NULL;stmnt=stmnt->next){
+    index++;
+    astnode *prog=stmnt->statement;
+    if(!prog) continue;
+    if(!strcmp(prog->identifier,"->")){
+      statementnode *rule=createStatement(copydeepASTNode(prog));
+      appendRule(e, rule);
+      if(!e->runrules) e->runrules=rule;
+    }
+    else {
+      termindex reduced=brianStoreReduce(e, store, brianStoreTerm(store, prog));
+      if(reduced==BRIAN_NIL){
+        appendMessage(&e->errors, "Statement %d not reduced: term store full", index);
+      }
+      else {
+        stmnt->statement=brianLoadTerm(store, reduced);
+        freeAST(prog);
+      }
+      // only the rules outlive a statement
+      compactStore(store, BRIAN_NIL);
+    }
+  }
+  brianDestroyStore(store);
+}
+
+statementnode *brianStatements(brianengine *e){
+  return e->program;
+}
+
+statementnode *brianRules(brianengine *e){
+  return e->rules;
+}
+
+astnode *brianParseTerm(brianengine *e, const char *text, long length){
+  clearErrors(e);
+  parser *p=createParser(text, length, 0);
+  astnode *term=parseTerm(p);
+  if(!p->error){
+    skipSpace(p);
+    if(peekChar(p)=='.') p->pos++;
+    skipSpace(p);
+    if(p->pos<p->length) syntaxError(p, "unexpected text after term");
+  }
+  if(p->error) term=NULL;
+  if(p->errors) appendText(&e->errors, p->errors);
+  free(p->errors);
+  free(p);
+  return term;
+}
+
+astnode *brianReduce(brianengine *e, astnode *term){
+  clearErrors(e);
+  freeAST(e->result);
+  freeMemory(BRIAN_MEMORY_FORMULAS, e->resulttext);
+  e->resulttext=NULL;
+  e->result=reduceStatement(e, copydeepASTNode(term));
+  return e->result;
+}
+
+astnode *brianReduceText(brianengine *e, const char *text, long length){
+  astnode *term=brianParseTerm(e, text, length);
+  if(!term) return NULL;
+  astnode *result=brianReduce(e, term);
+  freeAST(term);
+  return result;
+}
+
+brianreduction *brianStartReduction(brianengine *e, astnode *term){
+  return createReduction(e, copydeepASTNode(term), NULL);
+}
+
+brianstatus brianContinue(brianreduction *r, brianbudget *budget){
+  brianstatus status=continueReduction(r, budget);
+  r->engine->samplephase=SAMPLE_IDLE;
+  return status;
+}
+
+long brianReductionCycle(brianreduction *r){
+  return r->status==BRIAN_CYCLE ? r->cyclelength : 0;
+}
+
+astnode *brianReductionTerm(brianreduction *r){
+  return r->term;
+}
+
+long brianReductionSteps(brianreduction *r){
+  return r->steps;
+}
+
+void brianFreeReduction(brianreduction *r){
+  if(!r) return;
+  freeAST(r->term);
+  freeReduction(r);
+}
+
+astnode *brianResult(brianengine *e){
+  return e->result;
+}
+
+const char *brianResultText(brianengine *e){
+  if(!e->result) return NULL;
+  if(!e->resulttext) e->resulttext=formulaText(e->result, false);
+  return e->resulttext;
+}
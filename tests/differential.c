@@ -0,0 +1,331 @@
+/*********************************
+* Brian
+* Copyright (c) 2023 Brian O'Dell
+*
+**********************************/
+
+// Random programs run every way brian can run them, which must all agree
+// with brianRun:
+//   differential [count [seed]]           pointer vs compact reducer, with
+//                                         and without --partial-eval and
+//                                         --profile-in, serial vs parallel
+//                                         parse
+//   differential programs count dir [seed]  writes programs for run.sh to
+//                                         compare with --emit-c
+//   differential results programfile      the results brianRun gives, as
+//                                         code from --emit-c prints them
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brian.h"
+
+#define MAX_STEPS 2000
+#define MAX_NODES 20000
+#define RULES_PER_PROGRAM 7
+#define STATEMENTS_PER_PROGRAM 5
+#define PARSE_TEXT_LENGTH (1200L*1024)
+#define PARSE_PIECE_LENGTH (256L*1024)
+
+// Heads that overlap, bodies that build other rules' redexes, variable
+// functions and rules that grow the term.
+const char *rulePool[]={
+  "cons@(A,[B]) -> [A,B].", "car@([A,B]) -> A.", "cdr@([A,B]) -> [B].",
+  "swap@([A,B]) -> [B,A].", "dup@X -> [X,X].", "f@(g@X) -> (h@X).",
+  "h@a -> b.", "g@X -> (h@X).", "a -> c.", "car@([a,B]) -> z.",
+  "k@X -> (car@([X,b])).", "m@X -> (h@a).", "n@X -> (cdr@([a,X])).",
+  "p@X -> (g@(h@X)).", "q@X -> (dup@(swap@([X,a]))).", "f@X -> a.",
+  "g@(f@Y) -> b.", "X@Y -> (k@Y).", "k@(k@X) -> X.", "[A,B] -> (pair@(A)).",
+  "f@(j0) -> yes.", "f@X -> no.", "i -> j0.", "go -> (f@(i)).",
+  "r@X -> (f@(i)).", "s@(j0) -> t.", "k -> i.", NULL
+};
+
+const char *functions[]={
+  "cons", "car", "cdr", "swap", "f", "g", "h", "dup", "k", "m", "n", "p",
+  "q", "r", "s", NULL
+};
+
+const char *leaves[]={"a", "b", "c", "1", "i", "k", "go", "j0", NULL};
+
+unsigned long long randomstate;
+
+unsigned int nextRandom(unsigned int n){
+  randomstate^=randomstate<<13;
+  randomstate^=randomstate>>7;
+  randomstate^=randomstate<<17;
+  return (unsigned int)(randomstate>>11)%n;
+}
+
+int countOf(const char **list){
+  int n=0;
+  while(list[n]) n++;
+  return n;
+}
+
+/*********************************************************
+ * Program Text
+**********************************************************/
+
+typedef struct TEXTBUFFER{
+  char *text;
+  long length;
+  long capacity;
+} textbuffer;
+
+void putText(textbuffer *b, const char *format, ...){
+  va_list args;
+  va_start(args, format);
+  int n=vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  if(b->length+n+1>b->capacity){
+    while(b->length+n+1>b->capacity) b->capacity=b->capacity ? b->capacity*2 : 1024;
+    b->text=realloc(b->text, b->capacity);
+  }
+  va_start(args, format);
+  vsnprintf(b->text+b->length, n+1, format, args);
+  va_end(args);
+  b->length+=n;
+}
+
+void randomTerm(textbuffer *b, int depth, bool variables){
+  unsigned int r=nextRandom(10);
+  if(depth>4 || r<3){
+    if(variables && nextRandom(8)==0) putText(b, "X");
+    else putText(b, "%s", leaves[nextRandom(countOf(leaves))]);
+  }
+  else if(r<5){
+    int n=1+nextRandom(3);
+    putText(b, "[");
+    for(int k=0;k<n;k++){
+      if(k) putText(b, ",");
+      randomTerm(b, depth+1, variables);
+    }
+    putText(b, "]");
+  }
+  else {
+    putText(b, "%s@(", functions[nextRandom(countOf(functions))]);
+    randomTerm(b, depth+1, variables);
+    putText(b, ")");
+  }
+}
+
+// A few rules from the pool, in random order, then statements.  Code from
+// --emit-c treats a variable in a statement as an ordinary term, so its
+// programs have none.
+void randomProgram(textbuffer *b, bool variables){
+  int poolsize=countOf(rulePool);
+  bool used[64]={false};
+  for(int k=0;k<RULES_PER_PROGRAM;k++){
+    int r=nextRandom(poolsize);
+    while(used[r]) r=(r+1)%poolsize;
+    used[r]=true;
+    putText(b, "%s\n", rulePool[r]);
+  }
+  for(int k=0;k<STATEMENTS_PER_PROGRAM;k++){
+    randomTerm(b, 0, variables);
+    putText(b, ".\n");
+  }
+}
+
+/*********************************************************
+ * Runs
+**********************************************************/
+
+bool isRule(astnode *statement){
+  return statement && !strcmp(statement->identifier, "->");
+}
+
+// the formulas of the program's statements, one a line, with or
+// without its rules
+char *resultText(brianengine *e, bool rules){
+  textbuffer b={NULL, 0, 0};
+  putText(&b, "");
+  for(statementnode *s=brianStatements(e);s!=NULL;s=s->next){
+    if(!s->statement || (!rules && isRule(s->statement))) continue;
+    char *f=getFormula(s->statement, false);
+    putText(&b, "%s.\n", f);
+    free(f);
+  }
+  return b.text;
+}
+
+brianengine *loadProgram(const char *text){
+  brianengine *e=brianCreate();
+  brianLoad(e, text, strlen(text));
+  brianbudget budget={MAX_STEPS, MAX_NODES, 0};
+  brianSetBudget(e, &budget);
+  return e;
+}
+
+// The results brianRun gives, or NULL if a statement ran out of budget.
+char *runPointer(const char *text, bool partial, const char *profile){
+  brianengine *e=loadProgram(text);
+  if(partial) brianPartialEvaluate(e);
+  if(profile) brianOrderRules(e, profile);
+  char *result=brianRun(e) ? NULL : resultText(e, false);
+  brianDestroy(e);
+  return result;
+}
+
+char *runCompact(const char *text){
+  brianengine *e=loadProgram(text);
+  brianRunCompact(e);
+  char *result=resultText(e, false);
+  brianDestroy(e);
+  return result;
+}
+
+bool writeProfile(const char *text, const char *pathname){
+  brianengine *e=loadProgram(text);
+  brianSetProfiling(e, true);
+  brianRun(e);
+  bool written=brianWriteProfile(e, pathname);
+  brianDestroy(e);
+  return written;
+}
+
+int failures=0;
+
+void compare(const char *check, const char *program, const char *expected, const char *result){
+  if(!strcmp(expected, result)) return;
+  failures++;
+  if(failures>5) return;
+  printf("FAIL %s\n--- program\n%s--- brianRun\n%s--- %s\n%s\n", check, program, expected, check, result);
+}
+
+// Loading in pieces smaller than the parallel parse threshold parses
+// serially; loading the whole text may split it across threads.
+void compareParses(){
+  textbuffer b={NULL, 0, 0};
+  while(b.length<PARSE_TEXT_LENGTH){
+    randomProgram(&b, true);
+    if(nextRandom(4)==0) putText(&b, "oops ) %s.\n", leaves[nextRandom(countOf(leaves))]);
+  }
+  brianengine *whole=brianCreate();
+  int wholeerrors=brianLoad(whole, b.text, b.length);
+  brianengine *pieces=brianCreate();
+  int pieceerrors=0;
+  int piecemessages=0;
+  for(long start=0;start<b.length;){
+    long end=start+PARSE_PIECE_LENGTH<b.length ? start+PARSE_PIECE_LENGTH : b.length;
+    while(end<b.length && b.text[end-1]!='\n') end++;
+    pieceerrors+=brianLoad(pieces, b.text+start, end-start);
+    for(const char *c=brianErrors(pieces);c && *c;c++) piecemessages+=*c=='\n';
+    start=end;
+  }
+  int wholemessages=0;
+  for(const char *c=brianErrors(whole);c && *c;c++) wholemessages+=*c=='\n';
+  char *expected=resultText(pieces, true);
+  char *result=resultText(whole, true);
+  compare("parallel parse", "(generated)\n", expected, result);
+  if(wholeerrors!=pieceerrors || wholemessages!=piecemessages){
+    failures++;
+    printf("FAIL parse errors: %d errors and %d messages serially, %d and %d in parallel\n",
+      pieceerrors, piecemessages, wholeerrors, wholemessages);
+  }
+  free(expected);
+  free(result);
+  brianDestroy(whole);
+  brianDestroy(pieces);
+  free(b.text);
+}
+
+int compareRuns(int count){
+  char profile[]="/tmp/brianprofileXXXXXX";
+  int fd=mkstemp(profile);
+  if(fd<0){
+    printf("FAIL cannot create a profile file\n");
+    return 1;
+  }
+  close(fd);
+  int compared=0;
+  for(int n=0;n<count;n++){
+    textbuffer b={NULL, 0, 0};
+    randomProgram(&b, true);
+    char *expected=runPointer(b.text, false, NULL);
+    if(expected){
+      compared++;
+      char *result=runCompact(b.text);
+      compare("--compact", b.text, expected, result);
+      free(result);
+      result=runPointer(b.text, true, NULL);
+      compare("--partial-eval", b.text, expected, result ? result : "(out of budget)\n");
+      free(result);
+      if(writeProfile(b.text, profile)){
+        result=runPointer(b.text, false, profile);
+        compare("--profile-in", b.text, expected, result ? result : "(out of budget)\n");
+        free(result);
+      }
+    }
+    free(expected);
+    free(b.text);
+  }
+  unlink(profile);
+  compareParses();
+  brianmemory usage;
+  brianMemoryUsage(&usage);
+  if(usage.total!=0){
+    failures++;
+    printf("FAIL %ld bytes still counted after every engine was destroyed\n", usage.total);
+  }
+  printf("differential: %d programs, %d compared, %d failed\n", count, compared, failures);
+  return failures;
+}
+
+/*********************************************************
+ * Programs for --emit-c
+**********************************************************/
+
+int writePrograms(int count, const char *dir){
+  int written=0;
+  while(written<count){
+    textbuffer b={NULL, 0, 0};
+    randomProgram(&b, false);
+    char *expected=runPointer(b.text, false, NULL);
+    if(expected){
+      char pathname[4096];
+      snprintf(pathname, sizeof(pathname), "%s/program%d.b", dir, written++);
+      FILE *f=fopen(pathname, "w");
+      if(f==NULL){
+        printf("cannot write %s\n", pathname);
+        return 1;
+      }
+      fputs(b.text, f);
+      fclose(f);
+    }
+    free(expected);
+    free(b.text);
+  }
+  return 0;
+}
+
+int printResults(const char *pathname){
+  brianengine *e=brianCreate();
+  brianbudget budget={MAX_STEPS, MAX_NODES, 0};
+  brianSetBudget(e, &budget);
+  if(brianLoadFile(e, pathname)<0){
+    printf("cannot read %s\n", pathname);
+    return 1;
+  }
+  int suspended=brianRun(e);
+  char *result=resultText(e, false);
+  printf("%s", result);
+  free(result);
+  brianDestroy(e);
+  return suspended ? 1 : 0;
+}
+
+int main(int argc, char const *argv[]){
+  if(argc==3 && !strcmp(argv[1], "results")) return printResults(argv[2]);
+  if(argc>=4 && !strcmp(argv[1], "programs")){
+    randomstate=argc>4 ? strtoull(argv[4], NULL, 10)*2654435761u+1 : 1;
+    return writePrograms(atoi(argv[2]), argv[3]);
+  }
+  int count=argc>1 ? atoi(argv[1]) : 200;
+  randomstate=argc>2 ? strtoull(argv[2], NULL, 10)*2654435761u+1 : 1;
+  return compareRuns(count) ? 1 : 0;
+}
@@ -0,0 +1,5 @@
+f@(j0) -> yes.
+f@X -> no.
+i -> j0.
+go -> (f@(i)).
+go.
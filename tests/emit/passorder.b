@@ -0,0 +1,3 @@
+f@X -> a.
+g@(f@Y) -> b.
+g@(f@x).
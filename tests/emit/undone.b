@@ -0,0 +1,6 @@
+k -> i.
+X@Y -> (k@Y).
+k@(x).
+a -> b.
+b -> a.
+a.
@@ -0,0 +1,2 @@
+X@Y -> z.
+f@x.
@@ -0,0 +1,641 @@
+/*********************************
+* Brian
+* Copyright (c) 2023 Brian O'Dell
+*
+**********************************/
+
+// Programs that once gave wrong results, each checked against the result
+// brianRun gives or should give, and checks of parts of libbrian that
+// random programs reach too rarely.  Prints a line per check and exits
+// with the number that failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brian.h"
+
+int failures=0;
+
+void check(const char *name, bool passed, const char *detail){
+  if(passed){
+    printf("ok %s\n", name);
+  }
+  else {
+    printf("FAIL %s: %s\n", name, detail ? detail : "");
+    failures++;
+  }
+}
+
+brianengine *loadProgram(const char *text){
+  brianengine *e=brianCreate();
+  brianLoad(e, text, strlen(text));
+  return e;
+}
+
+// the formula of the last statement of the engine's program
+char *lastResult(brianengine *e){
+  statementnode *s=brianStatements(e);
+  while(s && s->next) s=s->next;
+  return s && s->statement ? getFormula(s->statement, false) : strdup("");
+}
+
+void checkResult(const char *name, brianengine *e, const char *expected){
+  char *result=lastResult(e);
+  check(name, !strcmp(result, expected), result);
+  free(result);
+}
+
+int countLines(const char *text){
+  int n=0;
+  for(;text && *text;text++) n+=*text=='\n';
+  return n;
+}
+
+/*********************************************************
+ * Scanning
+**********************************************************/
+
+// libbrian's block classifiers, which brian.h does not declare
+typedef struct CHARMASKS{
+  unsigned int space;
+  unsigned int newline;
+  unsigned int delim;
+  unsigned int quote;
+  unsigned int digit;
+  unsigned int alpha;
+  unsigned int op;
+} charmasks;
+
+extern unsigned char charclass[256];
+extern void (*classifyBlock)(const char *s, charmasks *m);
+void initScanner();
+void classifyBlockScalar(const char *s, charmasks *m);
+#if defined(__x86_64__) || defined(__i386__)
+void classifyBlockSSE2(const char *s, charmasks *m);
+void classifyBlockAVX2(const char *s, charmasks *m);
+#endif
+long scanWhile(const char *s, long i, long length, int classes);
+long scanUntil(const char *s, long i, long length, int classes);
+
+#define SCAN_CLASSES 7
+#define SCAN_TEXT_LENGTH 200
+
+// the index of the first byte at or after i whose class is (match) or is
+// not (!match) one of classes, a byte at a time from the table
+long scanTable(const char *s, long i, long length, int classes, bool match){
+  while(i<length && ((charclass[(unsigned char)s[i]] & classes)!=0)!=match) i++;
+  return i;
+}
+
+// Every byte value at every position of a block must get the table's
+// classes, and scans from every start must stop where the table says,
+// across block boundaries and into the bytewise tail.
+bool classifierMatchesTable(void (*classify)(const char *s, charmasks *m)){
+  const char *sample="a1 \n(\"+";
+  char block[32];
+  for(int b=0;b<256;b++){
+    for(int k=0;k<32;k++){
+      for(int j=0;j<32;j++) block[j]=sample[(j+b)%7];
+      block[k]=(char)b;
+      charmasks expected, result;
+      classifyBlockScalar(block, &expected);
+      classify(block, &result);
+      if(memcmp(&expected, &result, sizeof(charmasks))) return false;
+    }
+  }
+  // runs of one class, so scans cross whole blocks before stopping
+  const char *runs="aZ09 \t\n()[]{},.#\"+-*~\x80\xff";
+  char text[SCAN_TEXT_LENGTH];
+  unsigned int seed=12345;
+  for(int k=0;k<SCAN_TEXT_LENGTH;){
+    seed=seed*1103515245+12345;
+    char c=runs[(seed>>16)%strlen(runs)];
+    int length=(seed>>8)%48;
+    for(int j=0;j<length && k<SCAN_TEXT_LENGTH;j++) text[k++]=c;
+  }
+  void (*chosen)(const char *s, charmasks *m)=classifyBlock;
+  classifyBlock=classify;
+  bool same=true;
+  for(long start=0;start<SCAN_TEXT_LENGTH;start++){
+    for(int c=0;c<SCAN_CLASSES;c++){
+      same=same && scanUntil(text, start, SCAN_TEXT_LENGTH, 1<<c)==scanTable(text, start, SCAN_TEXT_LENGTH, 1<<c, true);
+      same=same && scanWhile(text, start, SCAN_TEXT_LENGTH, 1<<c)==scanTable(text, start, SCAN_TEXT_LENGTH, 1<<c, false);
+    }
+  }
+  classifyBlock=chosen;
+  return same;
+}
+
+void blockClassifiers(){
+  initScanner();
+  check("scalar block classifier agrees with the class table", classifierMatchesTable(classifyBlockScalar), NULL);
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse2")){
+    check("SSE2 block classifier agrees with the class table", classifierMatchesTable(classifyBlockSSE2), NULL);
+  }
+  if(__builtin_cpu_supports("avx2")){
+    check("AVX2 block classifier agrees with the class table", classifierMatchesTable(classifyBlockAVX2), NULL);
+  }
+#endif
+}
+
+/*********************************************************
+ * Parsing
+**********************************************************/
+
+// true if term is root applied to terms with the given identifiers
+bool grouped(astnode *term, const char *root, const char *left, const char *right){
+  return term && !strcmp(term->identifier, root)
+    && term->left && !strcmp(term->left->identifier, left)
+    && term->right && !strcmp(term->right->identifier, right);
+}
+
+void commaGrouping(){
+  brianengine *e=loadProgram("a,b->c. a,b,c. a@b,c. a,b@c.");
+  statementnode *s=brianStatements(e);
+  check("a,b->c parses as (a,b)->c", s && grouped(s->statement, "->", ",", "c"), NULL);
+  s=s ? s->next : NULL;
+  check("a,b,c parses as a,(b,c)", s && grouped(s->statement, ",", "a", ","), NULL);
+  s=s ? s->next : NULL;
+  check("a@b,c parses as (a@b),c", s && grouped(s->statement, ",", "@", "c"), NULL);
+  s=s ? s->next : NULL;
+  check("a,b@c parses as (a,b)@c", s && grouped(s->statement, "@", ",", "c"), NULL);
+  brianRun(e);
+  checkResult("a,b->c rewrites the function of a,b@c", e, "c@(c)");
+  brianDestroy(e);
+}
+
+/*********************************************************
+ * Reduction
+**********************************************************/
+
+// i->j0 overlaps no other head, but builds the redex f@(j0) that two
+// overlapping rules compete for, so it must not be applied early.
+void partialEvalFeedsOverlap(){
+  brianengine *e=loadProgram("f@(j0)->yes. f@X->no. i->j0. go->(f@(i)). go.");
+  brianPartialEvaluate(e);
+  brianRun(e);
+  checkResult("partial eval leaves rules feeding overlapping rules", e, "no");
+  brianDestroy(e);
+}
+
+void compactVariableFunction(){
+  brianengine *e=loadProgram("X@Y->z. f@x.");
+  brianRunCompact(e);
+  checkResult("compact matches a head with a variable function", e, "z");
+  brianDestroy(e);
+}
+
+// fifty passes over a 2000 element list, which once left 204,100 nodes
+void compactStoreStaysSmall(){
+  char *rules=malloc(64*50);
+  char *term=malloc(4*2000+8);
+  rules[0]=0;
+  for(int k=49;k>=0;k--) sprintf(rules+strlen(rules), "c%d->c%d. ", k, k+1);
+  strcpy(term, "[c0");
+  for(int k=1;k<2000;k++) strcat(term, ",c0");
+  strcat(term, "]");
+  brianengine *e=brianCreate();
+  brianLoadRules(e, rules, strlen(rules));
+  astnode *parsed=brianParseTerm(e, term, strlen(term));
+  briantermstore *s=brianCreateStore();
+  termindex reduced=brianStoreReduce(e, s, brianStoreTerm(s, parsed));
+  char *formula=brianStoreFormula(s, reduced);
+  char detail[64];
+  snprintf(detail, sizeof(detail), "%u nodes", brianStoreNodes(s));
+  check("compact store is compacted between passes", brianStoreNodes(s)<20000, detail);
+  check("compact store reduces the list", !strncmp(formula, "[c50,c50,", 9), formula);
+  free(formula);
+  brianDestroyStore(s);
+  freeAST(parsed);
+  brianDestroy(e);
+  free(term);
+  free(rules);
+}
+
+void runTwiceKeepsRules(){
+  brianengine *e=loadProgram("a->b. a.");
+  for(int k=0;k<3;k++) brianRun(e);
+  brianRunCompact(e);
+  int n=0;
+  for(statementnode *s=brianRules(e);s!=NULL;s=s->next) n++;
+  check("running again does not add the rules again", n==1, NULL);
+  checkResult("running again keeps the result", e, "b");
+  brianDestroy(e);
+}
+
+/*********************************************************
+ * Budgets
+**********************************************************/
+
+// fifty rules that take c0 to c50 in a single pass
+brianengine *chainEngine(){
+  char rules[1024];
+  rules[0]=0;
+  for(int k=0;k<50;k++) sprintf(rules+strlen(rules), "c%d->c%d. ", k, k+1);
+  brianengine *e=brianCreate();
+  brianLoadRules(e, rules, strlen(rules));
+  return e;
+}
+
+brianreduction *startReduction(brianengine *e, const char *text){
+  astnode *term=brianParseTerm(e, text, strlen(text));
+  brianreduction *r=brianStartReduction(e, term);
+  freeAST(term);
+  return r;
+}
+
+bool reductionIs(brianreduction *r, const char *expected){
+  char *formula=getFormula(brianReductionTerm(r), false);
+  bool same=!strcmp(formula, expected);
+  free(formula);
+  return same;
+}
+
+void stepBudget(){
+  brianengine *e=chainEngine();
+  brianreduction *r=startReduction(e, "c0");
+  brianbudget budget={7, 0, 0};
+  brianstatus status=brianContinue(r, &budget);
+  check("a step budget stops after exactly that many rewrites",
+    status==BRIAN_STEPS_EXHAUSTED && brianReductionSteps(r)==7 && reductionIs(r, "c7"), NULL);
+  status=brianContinue(r, NULL);
+  check("a reduction stopped by steps finishes as one run does",
+    status==BRIAN_DONE && brianReductionSteps(r)==50 && reductionIs(r, "c50"), NULL);
+  brianFreeReduction(r);
+  brianDestroy(e);
+}
+
+// Each rewrite of a turns one node into four.  Six a's in a list make 12
+// nodes, so the term passes 20 nodes at the third rewrite and 21 at the
+// fourth, and the budget is checked before every rewrite.
+void nodeBudget(){
+  brianengine *e=brianCreate();
+  brianLoadRules(e, "a->[b,b].", 9);
+  for(long limit=20;limit<=21;limit++){
+    brianreduction *r=startReduction(e, "[a,a,a,a,a,a]");
+    brianbudget budget={0, limit, 0};
+    brianstatus status=brianContinue(r, &budget);
+    char name[64];
+    snprintf(name, sizeof(name), "a %ld node budget stops at the first rewrite past it", limit);
+    check(name, status==BRIAN_NODES_EXHAUSTED && brianReductionSteps(r)==limit-17, NULL);
+    status=brianContinue(r, NULL);
+    check("a reduction stopped by nodes finishes as one run does", status==BRIAN_DONE
+      && reductionIs(r, "[[b,b],[b,b],[b,b],[b,b],[b,b],[b,b]]"), NULL);
+    brianFreeReduction(r);
+  }
+  brianDestroy(e);
+}
+
+// 30000 rewrites over a 600 element list, a millisecond at a time
+void timeBudget(){
+  char *text=malloc(4*600+8);
+  strcpy(text, "[c0");
+  for(int k=1;k<600;k++) strcat(text, ",c0");
+  strcat(text, "]");
+  brianengine *e=chainEngine();
+  brianreduction *whole=startReduction(e, text);
+  brianContinue(whole, NULL);
+  char *expected=getFormula(brianReductionTerm(whole), false);
+  brianreduction *r=startReduction(e, text);
+  brianbudget budget={0, 0, 1};
+  int slices=1;
+  brianstatus status;
+  while((status=brianContinue(r, &budget))==BRIAN_TIME_EXHAUSTED) slices++;
+  check("a time budget splits a long reduction into slices", slices>1, NULL);
+  check("a reduction stopped by time finishes as one run does", status==BRIAN_DONE
+    && reductionIs(r, expected) && brianReductionSteps(r)==brianReductionSteps(whole), NULL);
+  free(expected);
+  brianFreeReduction(whole);
+  brianFreeReduction(r);
+  brianDestroy(e);
+  free(text);
+}
+
+char *programResults(brianengine *e){
+  long length=0;
+  char *results=strdup("");
+  for(statementnode *s=brianStatements(e);s!=NULL;s=s->next){
+    char *f=getFormula(s->statement, false);
+    results=realloc(results, length+strlen(f)+3);
+    length+=sprintf(results+length, "%s.\n", f);
+    free(f);
+  }
+  return results;
+}
+
+// a run resumed one rewrite at a time ends where an unlimited run does
+void resumeOneStep(){
+  const char *program="cons@(A,[B]) -> [A,B]. car@([A,B]) -> A. cdr@([A,B]) -> [B].\n"
+    "car@(cdr@(cdr@(cons@(x,[a,b,c])))). cdr@(cons@(y,[z])). car@([q]).";
+  brianengine *e=loadProgram(program);
+  brianRun(e);
+  char *expected=programResults(e);
+  brianDestroy(e);
+  e=loadProgram(program);
+  brianbudget budget={1, 0, 0};
+  brianSetBudget(e, &budget);
+  int resumes=0;
+  for(int n=brianRun(e);n>0;n=brianResume(e)) resumes++;
+  char *result=programResults(e);
+  check("resuming one rewrite at a time gives the unlimited results", resumes>1 && !strcmp(expected, result), result);
+  free(expected);
+  free(result);
+  brianDestroy(e);
+}
+
+/*********************************************************
+ * Cycles
+**********************************************************/
+
+// Returns the length of the cycle the check finds in reducing text, or 0.
+long findCycle(briancyclecheck check, const char *rules, const char *text, brianstatus *status){
+  brianengine *e=brianCreate();
+  brianLoadRules(e, rules, strlen(rules));
+  brianSetCycleCheck(e, check, 8);
+  brianreduction *r=startReduction(e, text);
+  brianbudget budget={200, 0, 0};
+  *status=brianContinue(r, &budget);
+  long length=brianReductionCycle(r);
+  brianFreeReduction(r);
+  brianDestroy(e);
+  return length;
+}
+
+// Rules listed against the order they are used in move the term one
+// state a pass: s1, s2 and s3 come round every three passes, and s1 and
+// s2 alternate when there is no s3.  g@x only grows.
+void cycleChecks(){
+  const char *names[]={"window", "Brent"};
+  briancyclecheck checks[]={BRIAN_CYCLES_WINDOW, BRIAN_CYCLES_BRENT};
+  for(int k=0;k<2;k++){
+    brianstatus status;
+    char name[80];
+    long length=findCycle(checks[k], "s2->s0. s1->s2. s0->s1.", "s0", &status);
+    snprintf(name, sizeof(name), "the %s check finds a 2 pass cycle", names[k]);
+    check(name, status==BRIAN_CYCLE && length==2, NULL);
+    length=findCycle(checks[k], "s3->s0. s2->s3. s1->s2. s0->s1.", "s0", &status);
+    snprintf(name, sizeof(name), "the %s check finds a 3 pass cycle", names[k]);
+    check(name, status==BRIAN_CYCLE && length==3, NULL);
+    length=findCycle(checks[k], "g@X -> (g@([X])).", "g@x", &status);
+    snprintf(name, sizeof(name), "the %s check lets a term that never repeats run", names[k]);
+    check(name, status==BRIAN_STEPS_EXHAUSTED && length==0, NULL);
+  }
+}
+
+/*********************************************************
+ * Errors and Input and Output
+**********************************************************/
+
+void longErrorLogs(){
+  long length=24000*16;
+  char *text=malloc(length);
+  text[0]=0;
+  for(int k=0;k<24000;k++) sprintf(text+strlen(text), "a%d ) b.\n", k);
+  brianengine *e=brianCreate();
+  int errors=brianLoad(e, text, strlen(text));
+  char detail[64];
+  snprintf(detail, sizeof(detail), "%d errors, %d messages", errors, countLines(brianErrors(e)));
+  check("every syntax error is reported", errors==24000 && countLines(brianErrors(e))==24000, detail);
+  brianDestroy(e);
+  free(text);
+}
+
+void readHugeCount(){
+  char pathname[]="/tmp/brianreadXXXXXX";
+  int fd=mkstemp(pathname);
+  if(fd<0 || write(fd, "hello\n", 6)!=6){
+    check("read@ of a chunk too large to allocate", false, "cannot write a temporary file");
+    return;
+  }
+  close(fd);
+  char text[256];
+  snprintf(text, sizeof(text), "read@((open@\"%s\"),900000000000000).", pathname);
+  brianengine *e=loadProgram(text);
+  brianRun(e);
+  checkResult("read@ of a chunk too large to allocate", e, "error");
+  brianDestroy(e);
+  unlink(pathname);
+}
+
+/*********************************************************
+ * Watch Mode
+**********************************************************/
+
+void reloadResult(brianengine *e, const char *text, const char *name, const char *expected){
+  brianReload(e, text, strlen(text));
+  brianRun(e);
+  checkResult(name, e, expected);
+}
+
+void watchVariableFunction(){
+  brianengine *e=brianCreate();
+  brianSetIncremental(e, true);
+  reloadResult(e, "F@Y->old. f@x.", "watch reduces F@Y", "old");
+  reloadResult(e, "F@Y->new. f@x.", "watch sees an edited F@Y rule", "new");
+  brianDestroy(e);
+}
+
+void watchLongRule(){
+  char text[512];
+  char *as=malloc(301);
+  memset(as, 'a', 300);
+  as[300]=0;
+  brianengine *e=brianCreate();
+  brianSetIncremental(e, true);
+  snprintf(text, sizeof(text), "f@x->(g@(%s,old)). f@x.", as);
+  brianReload(e, text, strlen(text));
+  brianRun(e);
+  snprintf(text, sizeof(text), "f@x->(g@(%s,new)). f@x.", as);
+  brianReload(e, text, strlen(text));
+  brianRun(e);
+  char *result=lastResult(e);
+  check("watch sees an edit past 255 characters of a rule", strstr(result, ",new)")!=NULL, result);
+  free(result);
+  brianDestroy(e);
+  free(as);
+}
+
+// a result is dropped once its statement leaves the program
+void watchDropsResults(){
+  brianengine *e=brianCreate();
+  brianSetIncremental(e, true);
+  reloadResult(e, "a->b. a.", "watch reduces a", "b");
+  reloadResult(e, "a->b. c.", "watch reduces c", "c");
+  reloadResult(e, "a->b. a.", "watch reduces a again", "b");
+  check("watch forgets the result of a removed statement", brianReducedCount(e)==1, NULL);
+  brianDestroy(e);
+}
+
+/*********************************************************
+ * Sampling
+**********************************************************/
+
+// true if line is "frame;frame;... count" with no empty frame
+bool foldedLine(char *line){
+  char *space=strrchr(line, ' ');
+  if(!space || space==line || !space[1]) return false;
+  char *end;
+  long count=strtol(space+1, &end, 10);
+  if(count<=0 || (*end && *end!='\n')) return false;
+  for(char *c=line;c<space;c++){
+    if(*c=='\n' || (*c==';' && (c==line || c[-1]==';' || c+1==space))) return false;
+  }
+  return true;
+}
+
+void samplingFoldedStacks(){
+  long depth=500;
+  char *text=malloc(depth*4+64);
+  strcpy(text, "f@(s@X) -> (f@X). f@z -> z. f@");
+  long n=strlen(text);
+  for(long k=0;k<depth;k++) n+=sprintf(text+n, "(s@");
+  n+=sprintf(text+n, "z");
+  for(long k=0;k<depth;k++) text[n++]=')';
+  strcpy(text+n, ".");
+  brianengine *e=loadProgram(text);
+  free(text);
+  check("sampling starts", brianStartSampling(e, 1000), NULL);
+  brianRun(e);
+  brianStopSampling(e);
+  checkResult("a sampled run reduces as usual", e, "z");
+  char pathname[]="/tmp/briansamplesXXXXXX";
+  int fd=mkstemp(pathname);
+  if(fd<0 || !brianWriteSamples(e, pathname)){
+    check("samples are written as folded stacks", false, "cannot write a temporary file");
+    brianDestroy(e);
+    return;
+  }
+  close(fd);
+  FILE *f=fopen(pathname, "r");
+  char line[4096];
+  int lines=0;
+  bool folded=true;
+  while(fgets(line, sizeof(line), f)){
+    if(!foldedLine(line)) folded=false;
+    lines++;
+  }
+  fclose(f);
+  unlink(pathname);
+  check("samples are written as folded stacks", lines>0 && folded, line);
+  brianDestroy(e);
+}
+
+void samplingOneEngine(){
+  brianengine *a=brianCreate();
+  brianengine *b=brianCreate();
+  check("a first engine can be sampled", brianStartSampling(a, 10000), NULL);
+  check("a second engine cannot be sampled at the same time", !brianStartSampling(b, 10000), NULL);
+  brianStopSampling(b);
+  brianStopSampling(a);
+  check("a second engine can be sampled once the first stops", brianStartSampling(b, 10000), NULL);
+  brianStopSampling(b);
+  brianDestroy(a);
+  brianDestroy(b);
+}
+
+/*********************************************************
+ * Memory
+**********************************************************/
+
+// a resumed statement is not charged for what later statements took
+void resumeMemory(){
+  char *text=malloc(2048);
+  char *xs=malloc(301);
+  memset(xs, 'x', 300);
+  xs[300]=0;
+  strcpy(text, "a->b. b->c. g@X -> [X,X,X,X]. a.\n");
+  for(int k=0;k<3;k++) sprintf(text+strlen(text), "g@\"%s\".\n", xs);
+  free(xs);
+  brianengine *e=brianCreate();
+  brianLoad(e, text, strlen(text));
+  brianbudget budget={1, 0, 0};
+  brianSetBudget(e, &budget);
+  brianSetMemoryLimit(e, 200000, 0);
+  for(int n=brianRun(e);n>0;n=brianResume(e));
+  char *result=getFormula(brianStatements(e)->next->next->next->statement, false);
+  check("a resumed statement keeps its own memory limit", !strcmp(result, "c"), brianErrors(e));
+  free(result);
+  brianDestroy(e);
+  free(text);
+}
+
+void memoryBalances(){
+  brianmemory before, after;
+  brianMemoryUsage(&before);
+  brianengine *e=loadProgram("cons@(A,[B]) -> [A,B]. car@([A,B]) -> A. car@(cons@(x,[y,z])).");
+  brianRun(e);
+  brianDestroy(e);
+  brianMemoryUsage(&after);
+  char detail[64];
+  snprintf(detail, sizeof(detail), "%ld bytes before, %ld after", before.total, after.total);
+  check("memory counts return to where they were", before.total==after.total, detail);
+}
+
+// another engine's memory is not charged to this engine's run
+void runMemoryPerEngine(){
+  long length=20000;
+  char *text=malloc(length+4);
+  memset(text, 'x', length+2);
+  text[0]='"';
+  strcpy(text+length+1, "\".");
+  brianengine *large=loadProgram(text);
+  free(text);
+  brianmemory usage;
+  brianMemoryUsage(&usage);
+  check("the large engine holds over a megabyte", usage.total>1000000, NULL);
+  brianengine *small=loadProgram("a->b. a.");
+  brianSetMemoryLimit(small, 0, 1000000);
+  brianRun(small);
+  checkResult("a run limit ignores another engine's memory", small, "b");
+  brianDestroy(small);
+  brianengine *growing=loadProgram("g@X -> [g@X,g@X]. g@a.");
+  brianSetMemoryLimit(growing, 0, 100000);
+  brianRun(growing);
+  checkResult("a run limit still stops the engine's own growth", growing, "aborted");
+  brianDestroy(growing);
+  brianDestroy(large);
+}
+
+// a statement missing its period is skipped and its term freed
+void missingPeriod(){
+  brianmemory before, after;
+  brianMemoryUsage(&before);
+  brianengine *e=loadProgram("a->b. f@(a) g. a.");
+  checkResult("a statement missing its period is skipped", e, "a");
+  brianDestroy(e);
+  brianMemoryUsage(&after);
+  char detail[64];
+  snprintf(detail, sizeof(detail), "%ld bytes before, %ld after", before.total, after.total);
+  check("a statement missing its period is freed", before.total==after.total, detail);
+}
+
+int main(){
+  blockClassifiers();
+  commaGrouping();
+  partialEvalFeedsOverlap();
+  compactVariableFunction();
+  compactStoreStaysSmall();
+  runTwiceKeepsRules();
+  stepBudget();
+  nodeBudget();
+  timeBudget();
+  resumeOneStep();
+  cycleChecks();
+  longErrorLogs();
+  readHugeCount();
+  watchVariableFunction();
+  watchLongRule();
+  watchDropsResults();
+  samplingFoldedStacks();
+  samplingOneEngine();
+  resumeMemory();
+  memoryBalances();
+  missingPeriod();
+  runMemoryPerEngine();
+  return failures;
+}
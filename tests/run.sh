@@ -0,0 +1,44 @@
+#!/bin/sh
+# Runs the regression and differential checks, then compiles each program in
+# tests/emit with --emit-c and compares what the compiled reducer prints with
+# the .out file beside it.  A batch of random programs is compiled the same
+# way and compared with what brianRun gives.
+cd "$(dirname "$0")/.." || exit 1
+CC=${CC:-cc}
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+failed=0
+emitted=0
+
+tests/regression || failed=1
+tests/differential ${DIFFERENTIAL_COUNT:-200} || failed=1
+
+emitCheck(){
+  program=$1
+  expected=$2
+  if ! ./brian --emit-c "$work/rules.c" "$program" >/dev/null 2>&1 ||
+  ! $CC -O0 -I. "$work/rules.c" libbrian.a -pthread -o "$work/rules" 2>"$work/cc.log"; then
+    echo "FAIL --emit-c: $program does not compile"
+    cat "$work/cc.log"
+    failed=1
+    return
+  fi
+  "$work/rules" "$program" >"$work/result" 2>/dev/null
+  if ! cmp -s "$expected" "$work/result"; then
+    echo "FAIL --emit-c: $program"
+    diff "$expected" "$work/result"
+    failed=1
+  fi
+  emitted=$((emitted+1))
+}
+
+for program in tests/emit/*.b; do
+  emitCheck "$program" "${program%.b}.out"
+done
+tests/differential programs ${EMIT_COUNT:-40} "$work" || exit 1
+for program in "$work"/program*.b; do
+  tests/differential results "$program" >"$work/expected"
+  emitCheck "$program" "$work/expected"
+done
+echo "emit-c: $emitted programs compared"
+exit $failed